@@ -0,0 +1,13 @@
+#ifndef CPPJIEBA_CONSTANTS_HPP
+#define CPPJIEBA_CONSTANTS_HPP
+
+namespace cppjieba {
+
+// bounds of the log-probability weights shared by the dictionary and the
+// HMM model; MIN_DOUBLE stands for an impossible path
+const double MIN_DOUBLE = -3.14e+100;
+const double MAX_DOUBLE = 3.14e+100;
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_CONSTANTS_HPP
@@ -0,0 +1,412 @@
+#ifndef CPPJIEBA_DICT_IMAGE_H
+#define CPPJIEBA_DICT_IMAGE_H
+
+#include <stdint.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "limonp/Logging.hpp"
+
+namespace cppjieba {
+
+using namespace std;
+
+// Precompiled dictionary image: the dictionary units, the flat trie arrays,
+// the HMM tables and the keyword dictionaries written once by an offline
+// compile step and mapped read-only at startup, so loading skips text
+// parsing, log() and the trie build. Layout:
+//
+//   DictImageHeader | DictImageSection[sectionCount] | sections ...
+//
+// Every section starts on an 8-byte boundary. The checksum covers all bytes
+// after the header; a magic, version or checksum mismatch rejects the image.
+const char DICT_IMAGE_MAGIC[8] = {'J', 'I', 'E', 'B', 'A', 'I', 'M', 'G'};
+const uint32_t DICT_IMAGE_VERSION = 2;
+
+struct DictImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sectionCount;
+  uint64_t payloadSize;
+  uint64_t checksum;
+}; // struct DictImageHeader
+
+struct DictImageSection {
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+}; // struct DictImageSection
+
+// FNV-1a over 64-bit words, the tail byte by byte
+inline uint64_t DictImageChecksum(const char* data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 1099511628211ULL;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// "path size mtime" of a source file, empty when it cannot be stat'ed
+inline string DictSourceFingerprint(const string& path) {
+  struct stat st;
+  if (0 != stat(path.c_str(), &st)) {
+    return "";
+  }
+  ostringstream os;
+  os << path << ' ' << (unsigned long long)st.st_size << ' ' << (long long)st.st_mtime;
+  return os.str();
+}
+
+// string table section: uint32 count, uint32 offsets[count + 1], characters
+class DictImageStrings {
+ public:
+  DictImageStrings(): count_(0), offsets_(NULL), chars_(NULL) {
+  }
+  bool Attach(const char* data, size_t size) {
+    if (size < sizeof(uint32_t)) {
+      return false;
+    }
+    memcpy(&count_, data, sizeof(count_));
+    size_t head = sizeof(uint32_t) * (2 + size_t(count_));
+    if (size < head) {
+      return false;
+    }
+    offsets_ = reinterpret_cast<const uint32_t*>(data + sizeof(uint32_t));
+    chars_ = data + head;
+    // operator[] subtracts neighbouring offsets unchecked, so they must not
+    // decrease; the checksum only guards against accidental corruption
+    for (size_t i = 0; i < count_; i++) {
+      if (offsets_[i] > offsets_[i + 1]) {
+        return false;
+      }
+    }
+    return offsets_[count_] <= size - head;
+  }
+  size_t size() const {
+    return count_;
+  }
+  string operator[](size_t i) const {
+    return string(chars_ + offsets_[i], offsets_[i + 1] - offsets_[i]);
+  }
+
+  static string Encode(const vector<string>& strs) {
+    vector<uint32_t> offsets(1, 0);
+    size_t total = 0;
+    for (size_t i = 0; i < strs.size(); i++) {
+      total += strs[i].size();
+      offsets.push_back(uint32_t(total));
+    }
+    uint32_t count = uint32_t(strs.size());
+    string out(reinterpret_cast<const char*>(&count), sizeof(count));
+    out.append(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32_t));
+    for (size_t i = 0; i < strs.size(); i++) {
+      out += strs[i];
+    }
+    return out;
+  }
+
+ private:
+  uint32_t count_;
+  const uint32_t* offsets_;
+  const char* chars_;
+}; // class DictImageStrings
+
+class DictImageWriter {
+ public:
+  void Add(uint32_t id, const string& bytes) {
+    sections_.push_back(make_pair(id, bytes));
+  }
+  void Add(uint32_t id, const void* data, size_t size) {
+    Add(id, string(static_cast<const char*>(data), size));
+  }
+  template <class T>
+  void AddArray(uint32_t id, const vector<T>& items) {
+    Add(id, items.data(), items.size() * sizeof(T));
+  }
+  void AddStrings(uint32_t id, const vector<string>& strs) {
+    Add(id, DictImageStrings::Encode(strs));
+  }
+
+  bool Write(const string& path) const {
+    vector<DictImageSection> table(sections_.size());
+    uint64_t offset = Align(sizeof(DictImageHeader) + table.size() * sizeof(DictImageSection));
+    for (size_t i = 0; i < sections_.size(); i++) {
+      table[i].id = sections_[i].first;
+      table[i].reserved = 0;
+      table[i].offset = offset;
+      table[i].size = sections_[i].second.size();
+      offset = Align(offset + table[i].size);
+    }
+
+    string payload(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(DictImageSection));
+    for (size_t i = 0; i < sections_.size(); i++) {
+      payload.resize(table[i].offset - sizeof(DictImageHeader), '\0');
+      payload += sections_[i].second;
+    }
+    payload.resize(offset - sizeof(DictImageHeader), '\0');
+
+    DictImageHeader header;
+    memcpy(header.magic, DICT_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = DICT_IMAGE_VERSION;
+    header.sectionCount = uint32_t(table.size());
+    header.payloadSize = payload.size();
+    header.checksum = DictImageChecksum(payload.data(), payload.size());
+
+    // write aside and rename, so a reader never maps a half-written image
+    string tmp = path + ".tmp";
+    {
+      ofstream ofs(tmp.c_str(), ios::binary | ios::trunc);
+      if (!ofs.is_open()) {
+        XLOG(ERROR) << "open " << tmp << " failed";
+        return false;
+      }
+      ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      ofs.write(payload.data(), payload.size());
+      if (!ofs.good()) {
+        XLOG(ERROR) << "write " << tmp << " failed";
+        return false;
+      }
+    }
+    if (0 != rename(tmp.c_str(), path.c_str())) {
+      XLOG(ERROR) << "rename " << tmp << " to " << path << " failed";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  static uint64_t Align(uint64_t n) {
+    return (n + 7) & ~uint64_t(7);
+  }
+
+  vector<pair<uint32_t, string> > sections_;
+}; // class DictImageWriter
+
+// Read-only view of an image file, memory-mapped where available. Structures
+// loaded from it may point into the mapping, so it must outlive them.
+class DictImage {
+ public:
+  enum {
+    SOURCES = 1,
+    DICT_META = 2,
+    DICT_UNITS = 3,
+    DICT_RUNES = 4,
+    DICT_TAGS = 5,
+    DICT_USER_SINGLES = 6,
+    TRIE_NODES = 7,
+    TRIE_EDGES = 8,
+    TRIE_ROOT = 9,
+    HMM_TABLES = 10,
+    HMM_EMITS = 11,
+    IDF_META = 12,
+    IDF_WORDS = 13,
+    IDF_VALUES = 14,
+    STOP_WORDS = 15,
+    TRIE_FAIL = 16,
+    TRIE_OUTPUT = 17,
+  };
+
+  DictImage(): data_(NULL), size_(0), mapped_(false) {
+  }
+  ~DictImage() {
+    Close();
+  }
+
+  // false without logging when the file does not exist
+  bool Open(const string& path) {
+    Close();
+    if (!Map(path)) {
+      return false;
+    }
+    if (!Validate()) {
+      XLOG(ERROR) << "dictionary image " << path << " rejected";
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  bool IsOpen() const {
+    return NULL != data_;
+  }
+
+  // true when the image was compiled from exactly these files, as they are now
+  bool MatchesSources(const vector<string>& paths) const {
+    const char* data;
+    size_t size;
+    DictImageStrings recorded;
+    if (!Section(SOURCES, data, size) || !recorded.Attach(data, size) || recorded.size() != paths.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+      string current = DictSourceFingerprint(paths[i]);
+      if (current.empty() || current != recorded[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool Section(uint32_t id, const char*& data, size_t& size) const {
+    const DictImageSection* table = reinterpret_cast<const DictImageSection*>(data_ + sizeof(DictImageHeader));
+    for (uint32_t i = 0; i < Header().sectionCount; i++) {
+      if (table[i].id == id) {
+        data = data_ + table[i].offset;
+        size = size_t(table[i].size);
+        return true;
+      }
+    }
+    return false;
+  }
+  template <class T>
+  bool Array(uint32_t id, const T*& items, size_t& count) const {
+    const char* data;
+    size_t size;
+    if (!Section(id, data, size) || 0 != size % sizeof(T)) {
+      return false;
+    }
+    items = reinterpret_cast<const T*>(data);
+    count = size / sizeof(T);
+    return true;
+  }
+  template <class T>
+  bool Record(uint32_t id, T& record) const {
+    const T* items;
+    size_t count;
+    if (!Array(id, items, count) || 1 != count) {
+      return false;
+    }
+    record = items[0];
+    return true;
+  }
+  bool Strings(uint32_t id, DictImageStrings& strs) const {
+    const char* data;
+    size_t size;
+    return Section(id, data, size) && strs.Attach(data, size);
+  }
+
+ private:
+  const DictImageHeader& Header() const {
+    return *reinterpret_cast<const DictImageHeader*>(data_);
+  }
+
+  bool Validate() const {
+    if (size_ < sizeof(DictImageHeader)) {
+      return false;
+    }
+    const DictImageHeader& header = Header();
+    if (0 != memcmp(header.magic, DICT_IMAGE_MAGIC, sizeof(header.magic))) {
+      XLOG(ERROR) << "bad magic";
+      return false;
+    }
+    if (header.version != DICT_IMAGE_VERSION) {
+      XLOG(ERROR) << "image version " << header.version << ", expected " << DICT_IMAGE_VERSION;
+      return false;
+    }
+    if (header.payloadSize != size_ - sizeof(DictImageHeader) ||
+        header.sectionCount * sizeof(DictImageSection) > header.payloadSize) {
+      XLOG(ERROR) << "truncated image";
+      return false;
+    }
+    if (header.checksum != DictImageChecksum(data_ + sizeof(DictImageHeader), size_t(header.payloadSize))) {
+      XLOG(ERROR) << "checksum mismatch";
+      return false;
+    }
+    const DictImageSection* table = reinterpret_cast<const DictImageSection*>(data_ + sizeof(DictImageHeader));
+    for (uint32_t i = 0; i < header.sectionCount; i++) {
+      if (0 != table[i].offset % 8 || table[i].offset > size_ || table[i].size > size_ - table[i].offset) {
+        XLOG(ERROR) << "section " << table[i].id << " out of bounds";
+        return false;
+      }
+    }
+    return true;
+  }
+
+#ifndef _WIN32
+  bool Map(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (ENOENT != errno) {
+        XLOG(ERROR) << "open " << path << " failed";
+      }
+      return false;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || 0 == st.st_size) {
+      close(fd);
+      return false;
+    }
+    void* addr = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == addr) {
+      XLOG(ERROR) << "mmap " << path << " failed";
+      return false;
+    }
+    data_ = static_cast<const char*>(addr);
+    size_ = size_t(st.st_size);
+    mapped_ = true;
+    return true;
+  }
+#else
+  bool Map(const string& path) {
+    ifstream ifs(path.c_str(), ios::binary);
+    if (!ifs.is_open()) {
+      return false;
+    }
+    ostringstream os;
+    os << ifs.rdbuf();
+    buffer_ = os.str();
+    if (buffer_.empty()) {
+      return false;
+    }
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+  }
+#endif
+
+  void Close() {
+#ifndef _WIN32
+    if (mapped_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+#else
+    buffer_.clear();
+#endif
+    data_ = NULL;
+    size_ = 0;
+    mapped_ = false;
+  }
+
+  DictImage(const DictImage&);
+  DictImage& operator=(const DictImage&);
+
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+#ifdef _WIN32
+  string buffer_;
+#endif
+}; // class DictImage
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_DICT_IMAGE_H
@@ -2,26 +2,55 @@
 #define CPPJIEBA_DICT_TRIE_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <cstring>
 #include <cstdlib>
 #include <cmath>
 #include <deque>
+#include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_set>
 #include "limonp/StringUtil.hpp"
 #include "limonp/Logging.hpp"
 #include "Unicode.hpp"
+#include "Constants.hpp"
 #include "Trie.hpp"
+#include "Epoch.hpp"
+#include "DictImage.hpp"
+#include "RuneClass.hpp"
 
 namespace cppjieba {
 
-const double MIN_DOUBLE = -3.14e+100;
-const double MAX_DOUBLE = 3.14e+100;
 const size_t DICT_COLUMN_NUM = 3;
 const char* const UNKNOWN_TAG = "";
 
+// dictionary image records, see DictTrie::Save
+struct DictImageMeta {
+  double freqSum;
+  double minWeight;
+  double maxWeight;
+  double medianWeight;
+  double userWordDefaultWeight;
+}; // struct DictImageMeta
+
+struct DictImageUnit {
+  double weight;
+  uint32_t runeBegin;
+  uint32_t runeCount;
+  uint32_t tag;
+  uint32_t reserved;
+}; // struct DictImageUnit
+
+// The trie is published as an immutable version behind an atomic pointer.
+// Lookups load the current version inside an epoch read section and never
+// lock; user word updates copy the current version under a writer mutex,
+// apply the change, rebuild the automaton and swap the copy in, and the
+// replaced version is freed through the epoch domain once no lookup can
+// still be walking it. Dictionary units are never freed, so units handed
+// out by a lookup outlive the version they were found in.
 class DictTrie {
  public:
   enum UserWordWeightOption {
@@ -30,21 +59,84 @@ class DictTrie {
     WordWeightMax,
   }; // enum UserWordWeightOption
 
-  DictTrie(const std::string& dict_path, const std::string& user_dict_paths = "", UserWordWeightOption user_word_weight_opt = WordWeightMedian) {
+  DictTrie(const std::string& dict_path, const std::string& user_dict_paths = "", UserWordWeightOption user_word_weight_opt = WordWeightMedian)
+    : trie_(NULL), version_(0) {
     Init(dict_path, user_dict_paths, user_word_weight_opt);
   }
 
+  // loads from a compiled image; the trie arrays stay in the mapping, so the
+  // image must outlive this object
+  explicit DictTrie(const DictImage& image)
+    : trie_(NULL), version_(0) {
+    XCHECK(LoadImage(image)) << "invalid dictionary image";
+  }
+
   ~DictTrie() {
-    delete trie_;
+    delete trie_.load();
+  }
+
+  // writes the units in trie value order, the weight statistics and the trie
+  // arrays; words inserted at runtime are kept, deleted ones stay unreachable
+  void Save(DictImageWriter& writer) const {
+    EpochDomain::ReadSection section;
+    const Trie* trie = trie_.load();
+    const std::vector<const DictUnit*>& values = trie->Values();
+    std::vector<DictImageUnit> units(values.size());
+    std::vector<Rune> runes;
+    std::vector<std::string> tags;
+    std::map<std::string, uint32_t> tagIds;
+    for (size_t i = 0; i < values.size(); i++) {
+      const DictUnit& unit = *values[i];
+      std::map<std::string, uint32_t>::iterator tag = tagIds.find(unit.tag);
+      if (tag == tagIds.end()) {
+        tag = tagIds.insert(std::make_pair(unit.tag, uint32_t(tags.size()))).first;
+        tags.push_back(unit.tag);
+      }
+      units[i].weight = unit.weight;
+      units[i].runeBegin = uint32_t(runes.size());
+      units[i].runeCount = uint32_t(unit.word.size());
+      units[i].tag = tag->second;
+      units[i].reserved = 0;
+      runes.insert(runes.end(), unit.word.begin(), unit.word.end());
+    }
+    DictImageMeta meta = {freq_sum_, min_weight_, max_weight_, median_weight_, user_word_default_weight_};
+    std::vector<Rune> singles;
+    user_dict_single_chinese_word_.Collect(RUNE_USER_SINGLE, singles);
+
+    writer.Add(DictImage::DICT_META, &meta, sizeof(meta));
+    writer.AddArray(DictImage::DICT_UNITS, units);
+    writer.AddArray(DictImage::DICT_RUNES, runes);
+    writer.AddStrings(DictImage::DICT_TAGS, tags);
+    writer.AddArray(DictImage::DICT_USER_SINGLES, singles);
+    writer.Add(DictImage::TRIE_NODES, trie->Nodes(), trie->NodeCount() * sizeof(TrieNode));
+    writer.Add(DictImage::TRIE_EDGES, trie->Edges(), trie->EdgeCount() * sizeof(TrieEdge));
+    writer.Add(DictImage::TRIE_ROOT, trie->RootTable(), Trie::ROOT_TABLE_SIZE * sizeof(uint32_t));
+    if (trie->HasAutomaton()) {
+      writer.Add(DictImage::TRIE_FAIL, trie->Fail(), trie->NodeCount() * sizeof(uint32_t));
+      writer.Add(DictImage::TRIE_OUTPUT, trie->Output(), trie->NodeCount() * sizeof(uint32_t));
+    }
   }
 
+  // versions published by updates always carry the automaton; this only
+  // matters for an image saved without it, whose DAG build walks instead
+  void BuildAutomaton() {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    if (trie_.load()->HasAutomaton()) {
+      return;
+    }
+    Trie* next = new Trie(*trie_.load());
+    Publish(next);
+  }
+
+  // updates may run while other threads segment; each publishes a new
+  // version and costs a copy of the trie, so they suit occasional words
+  // rather than bulk loading, which belongs in the user dictionary
   bool InsertUserWord(const std::string& word, const std::string& tag = UNKNOWN_TAG) {
     DictUnit node_info;
     if (!MakeNodeInfo(node_info, word, user_word_default_weight_, tag)) {
       return false;
     }
-    active_node_infos_.push_back(node_info);
-    trie_->InsertNode(node_info.word, &active_node_infos_.back());
+    InsertActiveNode(node_info);
     return true;
   }
 
@@ -54,8 +146,19 @@ class DictTrie {
     if (!MakeNodeInfo(node_info, word, weight , tag)) {
       return false;
     }
-    active_node_infos_.push_back(node_info);
-    trie_->InsertNode(node_info.word, &active_node_infos_.back());
+    InsertActiveNode(node_info);
+    return true;
+  }
+
+  // all words go into one published version, so a batch costs one copy
+  bool InsertUserWords(const std::vector<std::string>& words, const std::string& tag = UNKNOWN_TAG) {
+    std::vector<DictUnit> node_infos(words.size());
+    for (size_t i = 0; i < words.size(); i++) {
+      if (!MakeNodeInfo(node_infos[i], words[i], user_word_default_weight_, tag)) {
+        return false;
+      }
+    }
+    InsertActiveNodes(node_infos);
     return true;
   }
 
@@ -64,19 +167,30 @@ class DictTrie {
     if (!MakeNodeInfo(node_info, word, user_word_default_weight_, tag)) {
       return false;
     }
-    trie_->DeleteNode(node_info.word, &node_info);
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    Trie* next = new Trie(*trie_.load());
+    next->DeleteNode(node_info.word);
+    Publish(next);
     return true;
   }
 
+  // counts published updates; a result cut after reading one value may be
+  // stale once it reads another
+  uint64_t Version() const {
+    return version_.load();
+  }
+
   const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
-    return trie_->Find(begin, end);
+    EpochDomain::ReadSection section;
+    return trie_.load()->Find(begin, end);
   }
 
   void Find(RuneStrArray::const_iterator begin,
         RuneStrArray::const_iterator end,
         std::vector<struct Dag>&res,
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    trie_->Find(begin, end, res, max_word_len);
+    EpochDomain::ReadSection section;
+    trie_.load()->Find(begin, end, res, max_word_len);
   }
 
   bool Find(const std::string& word)
@@ -99,7 +213,7 @@ class DictTrie {
   }
 
   bool IsUserDictSingleChineseWord(const Rune& word) const {
-    return IsIn(user_dict_single_chinese_word_, word);
+    return user_dict_single_chinese_word_.Has(word, RUNE_USER_SINGLE);
   }
 
   double GetMinWeight() const {
@@ -128,7 +242,7 @@ class DictTrie {
         }
         static_node_infos_.push_back(node_info);
         if (node_info.word.size() == 1) {
-          user_dict_single_chinese_word_.insert(node_info.word[0]);
+          user_dict_single_chinese_word_.Set(node_info.word[0], RUNE_USER_SINGLE);
         }
   }
 
@@ -176,6 +290,108 @@ class DictTrie {
     CreateTrie(static_node_infos_);
   }
 
+  bool LoadImage(const DictImage& image) {
+    DictImageMeta meta;
+    const DictImageUnit* units;
+    size_t unitCount;
+    const Rune* runes;
+    size_t runeCount;
+    DictImageStrings tags;
+    const Rune* singles;
+    size_t singleCount;
+    const TrieNode* nodes;
+    size_t nodeCount;
+    const TrieEdge* edges;
+    size_t edgeCount;
+    const uint32_t* rootTable;
+    size_t rootCount;
+    if (!image.Record(DictImage::DICT_META, meta) ||
+        !image.Array(DictImage::DICT_UNITS, units, unitCount) ||
+        !image.Array(DictImage::DICT_RUNES, runes, runeCount) ||
+        !image.Strings(DictImage::DICT_TAGS, tags) ||
+        !image.Array(DictImage::DICT_USER_SINGLES, singles, singleCount) ||
+        !image.Array(DictImage::TRIE_NODES, nodes, nodeCount) ||
+        !image.Array(DictImage::TRIE_EDGES, edges, edgeCount) ||
+        !image.Array(DictImage::TRIE_ROOT, rootTable, rootCount)) {
+      XLOG(ERROR) << "dictionary sections missing";
+      return false;
+    }
+    if (0 == unitCount || 0 == nodeCount || Trie::ROOT_TABLE_SIZE != rootCount) {
+      XLOG(ERROR) << "dictionary sections malformed";
+      return false;
+    }
+
+    static_node_infos_.resize(unitCount);
+    for (size_t i = 0; i < unitCount; i++) {
+      const DictImageUnit& unit = units[i];
+      if (unit.runeBegin > runeCount || unit.runeCount > runeCount - unit.runeBegin || unit.tag >= tags.size()) {
+        XLOG(ERROR) << "dictionary unit " << i << " out of bounds";
+        return false;
+      }
+      DictUnit& node_info = static_node_infos_[i];
+      node_info.word = Unicode(runes + unit.runeBegin, runes + unit.runeBegin + unit.runeCount);
+      node_info.weight = unit.weight;
+      node_info.tag = tags[unit.tag];
+    }
+    // the trie is walked unchecked, so reject indexes that leave the arrays
+    for (size_t i = 0; i < nodeCount; i++) {
+      if (nodes[i].childBegin > edgeCount || nodes[i].childCount > edgeCount - nodes[i].childBegin ||
+          nodes[i].value > unitCount) {
+        XLOG(ERROR) << "trie node " << i << " out of bounds";
+        return false;
+      }
+    }
+    for (size_t i = 0; i < edgeCount; i++) {
+      if (edges[i].node >= nodeCount) {
+        XLOG(ERROR) << "trie edge " << i << " out of bounds";
+        return false;
+      }
+    }
+    for (size_t i = 0; i < rootCount; i++) {
+      if (rootTable[i] >= nodeCount) {
+        XLOG(ERROR) << "trie root entry " << i << " out of bounds";
+        return false;
+      }
+    }
+    // the automaton links are optional; without them Find walks
+    const uint32_t* fail = NULL;
+    const uint32_t* output = NULL;
+    size_t failCount;
+    size_t outputCount;
+    if (image.Array(DictImage::TRIE_FAIL, fail, failCount) &&
+        image.Array(DictImage::TRIE_OUTPUT, output, outputCount)) {
+      if (failCount != nodeCount || outputCount != nodeCount) {
+        XLOG(ERROR) << "trie automaton size mismatch";
+        return false;
+      }
+      for (size_t i = 0; i < nodeCount; i++) {
+        if (fail[i] >= nodeCount || output[i] >= nodeCount) {
+          XLOG(ERROR) << "trie automaton link " << i << " out of bounds";
+          return false;
+        }
+      }
+    } else {
+      fail = NULL;
+      output = NULL;
+    }
+
+    freq_sum_ = meta.freqSum;
+    min_weight_ = meta.minWeight;
+    max_weight_ = meta.maxWeight;
+    median_weight_ = meta.medianWeight;
+    user_word_default_weight_ = meta.userWordDefaultWeight;
+    for (size_t i = 0; i < singleCount; i++) {
+      user_dict_single_chinese_word_.Set(singles[i], RUNE_USER_SINGLE);
+    }
+
+    std::vector<const DictUnit*> values(unitCount);
+    for (size_t i = 0; i < unitCount; i++) {
+      values[i] = &static_node_infos_[i];
+    }
+    trie_.store(new Trie(nodes, nodeCount, edges, edgeCount, rootTable, fail, output, values));
+    return true;
+  }
+
   void CreateTrie(const std::vector<DictUnit>& dictUnits) {
     assert(dictUnits.size());
     std::vector<Unicode> words;
@@ -185,7 +401,33 @@ class DictTrie {
       valuePointers.push_back(&dictUnits[i]);
     }
 
-    trie_ = new Trie(words, valuePointers);
+    trie_.store(new Trie(words, valuePointers));
+  }
+
+  // the unit lives in a deque, so earlier units keep their addresses
+  void InsertActiveNode(const DictUnit& node_info) {
+    InsertActiveNodes(std::vector<DictUnit>(1, node_info));
+  }
+
+  void InsertActiveNodes(const std::vector<DictUnit>& node_infos) {
+    if (node_infos.empty()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    Trie* next = new Trie(*trie_.load());
+    for (size_t i = 0; i < node_infos.size(); i++) {
+      active_node_infos_.push_back(node_infos[i]);
+      next->InsertNode(node_infos[i].word, &active_node_infos_.back());
+    }
+    Publish(next);
+  }
+
+  // called with update_mutex_ held
+  void Publish(Trie* next) {
+    next->BuildAutomaton();
+    const Trie* previous = trie_.exchange(next);
+    version_.fetch_add(1);
+    EpochDomain::Instance().Retire(previous);
   }
 
   bool MakeNodeInfo(DictUnit& node_info,
@@ -266,14 +508,16 @@ class DictTrie {
 
   std::vector<DictUnit> static_node_infos_;
   std::deque<DictUnit> active_node_infos_; // must not be std::vector
-  Trie * trie_;
+  std::atomic<const Trie*> trie_; // current version
+  std::atomic<uint64_t> version_; // bumped after each publish
+  std::mutex update_mutex_; // serialises writers
 
   double freq_sum_;
   double min_weight_;
   double max_weight_;
   double median_weight_;
   double user_word_default_weight_;
-  std::unordered_set<Rune> user_dict_single_chinese_word_;
+  RuneClassTable user_dict_single_chinese_word_; // RUNE_USER_SINGLE bits
 };
 }
 
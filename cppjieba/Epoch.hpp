@@ -0,0 +1,197 @@
+#ifndef CPPJIEBA_EPOCH_HPP
+#define CPPJIEBA_EPOCH_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace cppjieba {
+
+// Epoch-based reclamation for structures that readers use without locks
+// while writers replace them wholesale. A reader stamps its thread's slot
+// with the global epoch for the length of a read section; a writer that
+// has unpublished an object retires it, which advances the epoch, and the
+// object is freed once no slot holds an epoch at or before its retirement.
+// Entering and leaving a section touch only the reader's own slot, so
+// readers never wait on writers. Slots are claimed per thread on first
+// use and released when the thread exits; when every slot is taken another
+// block of them is chained on, so any number of threads may read.
+class EpochDomain {
+  struct Slot;
+
+ public:
+  static const size_t BLOCK_SLOTS = 256;
+
+  static EpochDomain& Instance() {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  // pins the current epoch until destroyed; sections may nest
+  class ReadSection {
+   public:
+    ReadSection(): slot_(Instance().ThreadSlot()) {
+      if (0 == slot_.depth++) {
+        slot_.epoch.store(Instance().epoch_.load());
+      }
+    }
+    ~ReadSection() {
+      if (0 == --slot_.depth) {
+        slot_.epoch.store(IDLE, std::memory_order_release);
+      }
+    }
+
+   private:
+    ReadSection(const ReadSection&);
+    ReadSection& operator=(const ReadSection&);
+
+    Slot& slot_;
+  }; // class ReadSection
+
+  // object must already be unreachable for new readers
+  template <class T>
+  void Retire(const T* object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Retired retired = {epoch_.fetch_add(1), object, &Delete<T>};
+    retired_.push_back(retired);
+    ReclaimLocked();
+  }
+
+  void Reclaim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReclaimLocked();
+  }
+
+ private:
+  static const uint64_t IDLE = 0;
+
+  // one cache line each, so readers on different threads do not contend
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch; // IDLE outside read sections
+    std::atomic<bool> claimed;
+    size_t depth; // touched by the owning thread only
+  }; // struct Slot
+  // blocks are only ever appended, and freed with the domain
+  struct Block {
+    Slot slots[BLOCK_SLOTS];
+    std::atomic<Block*> next;
+    void* storage; // allocation holding a chained block
+    Block(): next(NULL), storage(NULL) {
+      for (size_t i = 0; i < BLOCK_SLOTS; i++) {
+        slots[i].epoch.store(IDLE);
+        slots[i].claimed.store(false);
+        slots[i].depth = 0;
+      }
+    }
+  }; // struct Block
+
+  // before C++17 operator new does not honour the slots' alignment
+  static Block* NewBlock() {
+    size_t space = sizeof(Block) + alignof(Block);
+    void* storage = ::operator new(space);
+    void* aligned = storage;
+    std::align(alignof(Block), sizeof(Block), aligned, space);
+    Block* block = new (aligned) Block();
+    block->storage = storage;
+    return block;
+  }
+  static void DeleteBlock(Block* block) {
+    void* storage = block->storage;
+    block->~Block();
+    ::operator delete(storage);
+  }
+  struct Retired {
+    uint64_t epoch;
+    const void* object;
+    void (*deleter)(const void*);
+  }; // struct Retired
+
+  // gives the slot back when its thread exits
+  struct Claim {
+    Slot* slot;
+    Claim(): slot(NULL) {
+    }
+    ~Claim() {
+      if (NULL != slot) {
+        slot->claimed.store(false, std::memory_order_release);
+      }
+    }
+  }; // struct Claim
+
+  EpochDomain(): epoch_(1) {
+  }
+  ~EpochDomain() {
+    for (size_t i = 0; i < retired_.size(); i++) {
+      retired_[i].deleter(retired_[i].object);
+    }
+    Block* block = head_.next.load();
+    while (NULL != block) {
+      Block* next = block->next.load();
+      DeleteBlock(block);
+      block = next;
+    }
+  }
+  EpochDomain(const EpochDomain&);
+  EpochDomain& operator=(const EpochDomain&);
+
+  Slot& ThreadSlot() {
+    static thread_local Claim claim;
+    for (Block* block = &head_; NULL == claim.slot; block = block->next.load()) {
+      for (size_t i = 0; i < BLOCK_SLOTS && NULL == claim.slot; i++) {
+        bool expected = false;
+        if (block->slots[i].claimed.compare_exchange_strong(expected, true)) {
+          claim.slot = &block->slots[i];
+        }
+      }
+      if (NULL == claim.slot && NULL == block->next.load()) {
+        // whoever loses the race drops its block and scans the winner's
+        Block* grown = NewBlock();
+        Block* expected = NULL;
+        if (!block->next.compare_exchange_strong(expected, grown)) {
+          DeleteBlock(grown);
+        }
+      }
+    }
+    return *claim.slot;
+  }
+
+  // a reader whose slot holds epoch e may have loaded any object retired
+  // at e or later; objects retired before the oldest such e are free
+  void ReclaimLocked() {
+    uint64_t oldest = UINT64_MAX;
+    for (const Block* block = &head_; NULL != block; block = block->next.load()) {
+      for (size_t i = 0; i < BLOCK_SLOTS; i++) {
+        uint64_t epoch = block->slots[i].epoch.load();
+        if (IDLE != epoch && epoch < oldest) {
+          oldest = epoch;
+        }
+      }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_.size(); i++) {
+      if (retired_[i].epoch < oldest) {
+        retired_[i].deleter(retired_[i].object);
+      } else {
+        retired_[kept++] = retired_[i];
+      }
+    }
+    retired_.resize(kept);
+  }
+
+  template <class T>
+  static void Delete(const void* object) {
+    delete static_cast<const T*>(object);
+  }
+
+  std::atomic<uint64_t> epoch_;
+  Block head_;
+  std::mutex mutex_;
+  std::vector<Retired> retired_;
+}; // class EpochDomain
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_EPOCH_HPP
@@ -33,13 +33,20 @@ class FullSegment: public SegmentBase {
   }
   void Cut(const string& sentence, 
         vector<Word>& words) const {
-    PreFilter pre_filter(symbols_, sentence);
+    SegmentContext ctx;
+    Cut(sentence, words, ctx);
+  }
+  void Cut(const string& sentence, 
+        vector<Word>& words,
+        SegmentContext& ctx) const {
+    PreFilter pre_filter(symbols_, sentence, ctx);
     PreFilter::Range range;
-    vector<WordRange> wrs;
+    vector<WordRange>& wrs = ctx.ranges;
+    wrs.clear();
     wrs.reserve(sentence.size()/2);
     while (pre_filter.HasNext()) {
       range = pre_filter.Next();
-      Cut(range.begin, range.end, wrs);
+      Cut(range.begin, range.end, wrs, ctx);
     }
     words.clear();
     words.reserve(wrs.size());
@@ -48,6 +55,13 @@ class FullSegment: public SegmentBase {
   void Cut(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<WordRange>& res) const {
+    SegmentContext ctx;
+    Cut(begin, end, res, ctx);
+  }
+  void Cut(RuneStrArray::const_iterator begin, 
+        RuneStrArray::const_iterator end, 
+        vector<WordRange>& res,
+        SegmentContext& ctx) const {
     // result of searching in trie tree
     LocalVector<pair<size_t, const DictUnit*> > tRes;
 
@@ -60,7 +74,7 @@ class FullSegment: public SegmentBase {
     // tmp variables
     size_t wordLen = 0;
     assert(dictTrie_);
-    vector<struct Dag> dags;
+    vector<struct Dag>& dags = ctx.dags;
     dictTrie_->Find(begin, end, dags);
     for (size_t i = 0; i < dags.size(); i++) {
       for (size_t j = 0; j < dags[i].nexts.size(); j++) {
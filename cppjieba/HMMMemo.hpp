@@ -0,0 +1,140 @@
+#ifndef CPPJIEBA_HMMMEMO_H
+#define CPPJIEBA_HMMMEMO_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "Unicode.hpp"
+
+namespace cppjieba {
+
+// Memo of Viterbi splits. MixSegment hands every run of single-character MP
+// results to the HMM, and in chat text the same short runs (names, slang)
+// recur constantly, so the split of each piece Viterbi would decode is
+// remembered by its runes and replayed instead of decoding it again.
+// Viterbi over a short piece costs about as much as a couple of cache
+// misses, so short pieces are not memoised and the memo is a direct-mapped
+// table of fixed-size slots holding the runes and the split inline: a probe
+// touches one slot and a colliding insert simply replaces it. The table is
+// split into stripes, each with its own mutex, so lookups and inserts may
+// come from several threads; a stripe is allocated on its first insert, so
+// an unused segmenter costs nothing.
+// The memo is off unless given a capacity: on the bundled chat logs about
+// half of the probes hit and the saving is within noise, so it only pays
+// for streams where long out-of-vocabulary runs repeat heavily.
+class HMMMemo {
+ public:
+  static const size_t MIN_RUN_LENGTH = 4;  // shorter pieces decode faster than a probe
+  static const size_t MAX_RUN_LENGTH = 15; // longer pieces are decoded directly
+  static const size_t STRIPE_COUNT = 64;
+
+  explicit HMMMemo(size_t capacity = 0) {
+    SetCapacity(capacity);
+  }
+
+  // capacity is rounded up to a power of two, 0 disables the memo;
+  // not thread safe, call before the memo is shared
+  void SetCapacity(size_t capacity) {
+    stripeSlots_ = 0;
+    if (capacity > 0) {
+      for (stripeSlots_ = 1; stripeSlots_ * STRIPE_COUNT < capacity; stripeSlots_ <<= 1) {
+      }
+    }
+    for (size_t i = 0; i < STRIPE_COUNT; i++) {
+      vector<Slot>().swap(stripes_[i].slots);
+    }
+  }
+
+  // appends the remembered words of [begin, end) to res
+  bool Lookup(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res) const {
+    if (!Memoizable(begin, end)) {
+      return false;
+    }
+    size_t length = end - begin;
+    uint64_t hash = Hash(begin, end);
+    Stripe& stripe = stripes_[hash % STRIPE_COUNT];
+    uint8_t lengths[MAX_RUN_LENGTH];
+    size_t wordCount;
+    {
+      std::lock_guard<std::mutex> lock(stripe.mutex);
+      if (stripe.slots.empty()) {
+        return false;
+      }
+      const Slot& slot = stripe.slots[(hash / STRIPE_COUNT) & (stripeSlots_ - 1)];
+      if (slot.hash != hash || slot.runeCount != length) {
+        return false;
+      }
+      for (size_t i = 0; i < length; i++) {
+        if (slot.runes[i] != begin[i].rune) {
+          return false;
+        }
+      }
+      wordCount = slot.wordCount;
+      std::copy(slot.lengths, slot.lengths + wordCount, lengths);
+    }
+    for (size_t i = 0; i < wordCount; i++) {
+      res.push_back(WordRange(begin, begin + lengths[i] - 1));
+      begin += lengths[i];
+    }
+    return true;
+  }
+
+  // [first, last) are the words [begin, end) was cut into
+  void Insert(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end,
+        vector<WordRange>::const_iterator first, vector<WordRange>::const_iterator last) const {
+    if (!Memoizable(begin, end) || size_t(last - first) > MAX_RUN_LENGTH) {
+      return;
+    }
+    uint64_t hash = Hash(begin, end);
+    Stripe& stripe = stripes_[hash % STRIPE_COUNT];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    if (stripe.slots.empty()) {
+      stripe.slots.resize(stripeSlots_);
+    }
+    Slot& slot = stripe.slots[(hash / STRIPE_COUNT) & (stripeSlots_ - 1)];
+    slot.hash = hash;
+    slot.runeCount = uint8_t(end - begin);
+    slot.wordCount = uint8_t(last - first);
+    for (size_t i = 0; i < slot.runeCount; i++) {
+      slot.runes[i] = begin[i].rune;
+    }
+    for (size_t i = 0; i < slot.wordCount; i++) {
+      slot.lengths[i] = uint8_t(first[i].right - first[i].left + 1);
+    }
+  }
+
+ private:
+  struct Slot {
+    uint64_t hash;
+    uint8_t runeCount; // 0 marks an empty slot
+    uint8_t wordCount;
+    uint8_t lengths[MAX_RUN_LENGTH]; // runes per word
+    Rune runes[MAX_RUN_LENGTH];
+    Slot(): hash(0), runeCount(0), wordCount(0) {
+    }
+  };
+  struct Stripe {
+    std::mutex mutex;
+    vector<Slot> slots; // stripeSlots_ slots once allocated
+  };
+
+  bool Memoizable(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
+    size_t length = end - begin;
+    return stripeSlots_ > 0 && length >= MIN_RUN_LENGTH && length <= MAX_RUN_LENGTH;
+  }
+  static uint64_t Hash(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (; begin != end; ++begin) {
+      hash = (hash ^ begin->rune) * 1099511628211ULL;
+    }
+    return hash ^ (hash >> 32);
+  }
+
+  size_t stripeSlots_;
+  mutable Stripe stripes_[STRIPE_COUNT];
+}; // class HMMMemo
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_HMMMEMO_H
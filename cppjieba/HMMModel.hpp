@@ -2,21 +2,48 @@
 #define CPPJIEBA_HMMMODEL_H
 
 #include "limonp/StringUtil.hpp"
-#include "Trie.hpp"
+#include "Unicode.hpp"
+#include "Constants.hpp"
+#include "DictImage.hpp"
 
 namespace cppjieba {
 
 using namespace limonp;
 typedef unordered_map<Rune, double> EmitProbMap;
 
+// HMM image records, see HMMModel::Save
+struct HMMImageTables {
+  double startProb[4];
+  double transProb[4][4];
+}; // struct HMMImageTables
+
+struct HMMImageEmit {
+  Rune rune;
+  uint32_t status;
+  double prob;
+}; // struct HMMImageEmit
+
 struct HMMModel {
   /*
    * STATUS:
    * 0: HMMModel::B, 1: HMMModel::E, 2: HMMModel::M, 3:HMMModel::S
    * */
   enum {B = 0, E = 1, M = 2, S = 3, STATUS_SUM = 4};
+  // dense emission rows are indexed through a 16-bit id for BMP runes
+  static const size_t EMIT_INDEX_SIZE = 0x10000;
+  static const uint16_t EMIT_OVERFLOW = 0xFFFF;
 
   HMMModel(const string& modelPath) {
+    Init();
+    LoadModel(modelPath);
+  }
+  explicit HMMModel(const DictImage& image) {
+    Init();
+    XCHECK(LoadImage(image)) << "invalid HMM image";
+  }
+  ~HMMModel() {
+  }
+  void Init() {
     memset(startProb, 0, sizeof(startProb));
     memset(transProb, 0, sizeof(transProb));
     statMap[0] = 'B';
@@ -27,9 +54,44 @@ struct HMMModel {
     emitProbVec.push_back(&emitProbE);
     emitProbVec.push_back(&emitProbM);
     emitProbVec.push_back(&emitProbS);
-    LoadModel(modelPath);
   }
-  ~HMMModel() {
+  // emissions are written per status in rune order, so images are reproducible
+  void Save(DictImageWriter& writer) const {
+    HMMImageTables tables;
+    memcpy(tables.startProb, startProb, sizeof(startProb));
+    memcpy(tables.transProb, transProb, sizeof(transProb));
+    vector<HMMImageEmit> emits;
+    for (size_t status = 0; status < STATUS_SUM; status++) {
+      vector<pair<Rune, double> > probs(emitProbVec[status]->begin(), emitProbVec[status]->end());
+      sort(probs.begin(), probs.end());
+      for (size_t i = 0; i < probs.size(); i++) {
+        HMMImageEmit emit = {probs[i].first, uint32_t(status), probs[i].second};
+        emits.push_back(emit);
+      }
+    }
+    writer.Add(DictImage::HMM_TABLES, &tables, sizeof(tables));
+    writer.AddArray(DictImage::HMM_EMITS, emits);
+  }
+  bool LoadImage(const DictImage& image) {
+    HMMImageTables tables;
+    const HMMImageEmit* emits;
+    size_t emitCount;
+    if (!image.Record(DictImage::HMM_TABLES, tables) ||
+        !image.Array(DictImage::HMM_EMITS, emits, emitCount)) {
+      XLOG(ERROR) << "HMM sections missing";
+      return false;
+    }
+    memcpy(startProb, tables.startProb, sizeof(startProb));
+    memcpy(transProb, tables.transProb, sizeof(transProb));
+    for (size_t i = 0; i < emitCount; i++) {
+      if (emits[i].status >= STATUS_SUM) {
+        XLOG(ERROR) << "HMM emission " << i << " has bad status";
+        return false;
+      }
+      (*emitProbVec[emits[i].status])[emits[i].rune] = emits[i].prob;
+    }
+    BuildEmitRows();
+    return true;
   }
   void LoadModel(const string& filePath) {
     ifstream ifile(filePath.c_str());
@@ -70,6 +132,54 @@ struct HMMModel {
     //Load emitProbS
     XCHECK(GetLine(ifile, line));
     XCHECK(LoadEmitProb(line, emitProbS));
+    BuildEmitRows();
+  }
+
+  // Dense copy of the emission maps: one row of STATUS_SUM probabilities per
+  // rune seen in the model, so Viterbi reads a rune's four emissions with one
+  // index load instead of four hash lookups. Row 0 is the fallback for unseen
+  // runes (MIN_DOUBLE in every state, as GetEmitProb's default). Runes outside
+  // the BMP, or past the 16-bit id space, resolve through emitOverflow.
+  void BuildEmitRows() {
+    vector<Rune> runes;
+    for (size_t y = 0; y < STATUS_SUM; y++) {
+      for (EmitProbMap::const_iterator it = emitProbVec[y]->begin(); it != emitProbVec[y]->end(); ++it) {
+        runes.push_back(it->first);
+      }
+    }
+    sort(runes.begin(), runes.end());
+    runes.erase(unique(runes.begin(), runes.end()), runes.end());
+
+    emitIndex.assign(EMIT_INDEX_SIZE, 0);
+    emitOverflow.clear();
+    emitRows.assign((runes.size() + 1) * STATUS_SUM, MIN_DOUBLE);
+    for (size_t i = 0; i < runes.size(); i++) {
+      uint32_t row = uint32_t(i + 1);
+      if (runes[i] < EMIT_INDEX_SIZE && row < EMIT_OVERFLOW) {
+        emitIndex[runes[i]] = uint16_t(row);
+      } else {
+        if (runes[i] < EMIT_INDEX_SIZE) {
+          emitIndex[runes[i]] = EMIT_OVERFLOW;
+        }
+        emitOverflow[runes[i]] = row;
+      }
+      for (size_t y = 0; y < STATUS_SUM; y++) {
+        emitRows[row * STATUS_SUM + y] = GetEmitProb(emitProbVec[y], runes[i], MIN_DOUBLE);
+      }
+    }
+  }
+  // the STATUS_SUM emission probabilities of a rune
+  const double* GetEmitRow(Rune rune) const {
+    uint32_t row = 0;
+    if (rune < EMIT_INDEX_SIZE && emitIndex[rune] != EMIT_OVERFLOW) {
+      row = emitIndex[rune];
+    } else {
+      unordered_map<Rune, uint32_t>::const_iterator it = emitOverflow.find(rune);
+      if (it != emitOverflow.end()) {
+        row = it->second;
+      }
+    }
+    return &emitRows[row * STATUS_SUM];
   }
   double GetEmitProb(const EmitProbMap* ptMp, Rune key, 
         double defVal)const {
@@ -122,6 +232,9 @@ struct HMMModel {
   EmitProbMap emitProbM;
   EmitProbMap emitProbS;
   vector<EmitProbMap* > emitProbVec;
+  vector<uint16_t> emitIndex;
+  vector<double> emitRows;
+  unordered_map<Rune, uint32_t> emitOverflow;
 }; // struct HMMModel
 
 } // namespace cppjieba
@@ -6,16 +6,17 @@
 #include <memory.h>
 #include <cassert>
 #include "HMMModel.hpp"
+#include "HMMMemo.hpp"
 #include "SegmentBase.hpp"
 
 namespace cppjieba {
 class HMMSegment: public SegmentBase {
  public:
   HMMSegment(const string& filePath)
-  : model_(new HMMModel(filePath)), isNeedDestroy_(true) {
+  : model_(new HMMModel(filePath)), isNeedDestroy_(true), classes_(StaticRuneClasses()) {
   }
   HMMSegment(const HMMModel* model) 
-  : model_(model), isNeedDestroy_(false) {
+  : model_(model), isNeedDestroy_(false), classes_(StaticRuneClasses()) {
   }
   ~HMMSegment() {
     if (isNeedDestroy_) {
@@ -23,6 +24,12 @@ class HMMSegment: public SegmentBase {
     }
   }
 
+  // pieces kept in the Viterbi memo, 0 disables it; not thread safe, call
+  // before the segment is shared
+  void SetMemoCapacity(size_t capacity) {
+    memo_.SetCapacity(capacity);
+  }
+
   void Cut(const string& sentence, 
         vector<string>& words) const {
     vector<Word> tmp;
@@ -31,25 +38,36 @@ class HMMSegment: public SegmentBase {
   }
   void Cut(const string& sentence, 
         vector<Word>& words) const {
-    PreFilter pre_filter(symbols_, sentence);
+    SegmentContext ctx;
+    Cut(sentence, words, ctx);
+  }
+  void Cut(const string& sentence, 
+        vector<Word>& words,
+        SegmentContext& ctx) const {
+    PreFilter pre_filter(symbols_, sentence, ctx);
     PreFilter::Range range;
-    vector<WordRange> wrs;
+    vector<WordRange>& wrs = ctx.ranges;
+    wrs.clear();
     wrs.reserve(sentence.size()/2);
     while (pre_filter.HasNext()) {
       range = pre_filter.Next();
-      Cut(range.begin, range.end, wrs);
+      Cut(range.begin, range.end, wrs, ctx);
     }
     words.clear();
     words.reserve(wrs.size());
     GetWordsFromWordRanges(sentence, wrs, words);
   }
   void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res) const {
+    SegmentContext ctx;
+    Cut(begin, end, res, ctx);
+  }
+  void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, SegmentContext& ctx) const {
     RuneStrArray::const_iterator left = begin;
     RuneStrArray::const_iterator right = begin;
     while (right != end) {
       if (right->rune < 0x80) {
         if (left != right) {
-          InternalCut(left, right, res);
+          InternalCut(left, right, res, ctx);
         }
         left = right;
         do {
@@ -71,21 +89,19 @@ class HMMSegment: public SegmentBase {
       }
     }
     if (left != right) {
-      InternalCut(left, right, res);
+      InternalCut(left, right, res, ctx);
     }
   }
  private:
   // sequential letters rule
   RuneStrArray::const_iterator SequentialLetterRule(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
-    Rune x = begin->rune;
-    if (('a' <= x && x <= 'z') || ('A' <= x && x <= 'Z')) {
+    if (classes_.Has(begin->rune, RUNE_LETTER)) {
       begin ++;
     } else {
       return begin;
     }
     while (begin != end) {
-      x = begin->rune;
-      if (('a' <= x && x <= 'z') || ('A' <= x && x <= 'Z') || ('0' <= x && x <= '9')) {
+      if (classes_.Has(begin->rune, RUNE_LETTER | RUNE_DIGIT)) {
         begin ++;
       } else {
         break;
@@ -95,15 +111,13 @@ class HMMSegment: public SegmentBase {
   }
   //
   RuneStrArray::const_iterator NumbersRule(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
-    Rune x = begin->rune;
-    if ('0' <= x && x <= '9') {
+    if (classes_.Has(begin->rune, RUNE_DIGIT)) {
       begin ++;
     } else {
       return begin;
     }
     while (begin != end) {
-      x = begin->rune;
-      if ( ('0' <= x && x <= '9') || x == '.') {
+      if (classes_.Has(begin->rune, RUNE_DIGIT) || begin->rune == '.') {
         begin++;
       } else {
         break;
@@ -111,9 +125,17 @@ class HMMSegment: public SegmentBase {
     }
     return begin;
   }
-  void InternalCut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res) const {
-    vector<size_t> status;
-    Viterbi(begin, end, status);
+  void InternalCut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, SegmentContext& ctx) const {
+    if (end - begin == 1) { // Viterbi always ends a lone rune in E or S
+      res.push_back(WordRange(begin, begin));
+      return;
+    }
+    if (memo_.Lookup(begin, end, res)) {
+      return;
+    }
+    size_t first = res.size();
+    vector<size_t>& status = ctx.status;
+    Viterbi(begin, end, status, ctx);
 
     RuneStrArray::const_iterator left = begin;
     RuneStrArray::const_iterator right;
@@ -125,64 +147,71 @@ class HMMSegment: public SegmentBase {
         left = right;
       }
     }
+    memo_.Insert(begin, end, res.begin() + first, res.end());
   }
 
+  // Rune-major layout: the STATUS_SUM cells of a rune are adjacent, so a
+  // step reads one contiguous row of the previous column and one emission
+  // row. The inner loop runs across the current states with fixed bounds and
+  // no aliasing, which the compiler unrolls and vectorises; preY stays the
+  // outer loop so ties resolve to the lowest predecessor as before.
   void Viterbi(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
-        vector<size_t>& status) const {
-    size_t Y = HMMModel::STATUS_SUM;
+        vector<size_t>& status,
+        SegmentContext& ctx) const {
+    const size_t Y = HMMModel::STATUS_SUM;
     size_t X = end - begin;
 
-    size_t XYSize = X * Y;
-    size_t now, old, stat;
-    double tmp, endE, endS;
-
-    vector<int> path(XYSize);
-    vector<double> weight(XYSize);
+    // every cell is written before it is read, so reused buffers need no reset
+    vector<int>& path = ctx.path;
+    vector<double>& weight = ctx.weight;
+    path.resize(X * Y);
+    weight.resize(X * Y);
 
     //start
+    const double* emit = model_->GetEmitRow(begin->rune);
     for (size_t y = 0; y < Y; y++) {
-      weight[0 + y * X] = model_->startProb[y] + model_->GetEmitProb(model_->emitProbVec[y], begin->rune, MIN_DOUBLE);
-      path[0 + y * X] = -1;
+      weight[y] = model_->startProb[y] + emit[y];
+      path[y] = -1;
     }
 
-    double emitProb;
-
     for (size_t x = 1; x < X; x++) {
+      emit = model_->GetEmitRow((begin + x)->rune);
+      double prev[HMMModel::STATUS_SUM];
+      double best[HMMModel::STATUS_SUM];
+      int from[HMMModel::STATUS_SUM];
       for (size_t y = 0; y < Y; y++) {
-        now = x + y*X;
-        weight[now] = MIN_DOUBLE;
-        path[now] = HMMModel::E; // warning
-        emitProb = model_->GetEmitProb(model_->emitProbVec[y], (begin+x)->rune, MIN_DOUBLE);
-        for (size_t preY = 0; preY < Y; preY++) {
-          old = x - 1 + preY * X;
-          tmp = weight[old] + model_->transProb[preY][y] + emitProb;
-          if (tmp > weight[now]) {
-            weight[now] = tmp;
-            path[now] = preY;
-          }
+        prev[y] = weight[(x - 1) * Y + y];
+        best[y] = MIN_DOUBLE;
+        from[y] = HMMModel::E; // warning
+      }
+      for (size_t preY = 0; preY < Y; preY++) {
+        const double* trans = model_->transProb[preY];
+        for (size_t y = 0; y < Y; y++) {
+          double tmp = prev[preY] + trans[y] + emit[y];
+          bool better = tmp > best[y];
+          best[y] = better ? tmp : best[y];
+          from[y] = better ? int(preY) : from[y];
         }
       }
+      for (size_t y = 0; y < Y; y++) {
+        weight[x * Y + y] = best[y];
+        path[x * Y + y] = from[y];
+      }
     }
 
-    endE = weight[X-1+HMMModel::E*X];
-    endS = weight[X-1+HMMModel::S*X];
-    stat = 0;
-    if (endE >= endS) {
-      stat = HMMModel::E;
-    } else {
-      stat = HMMModel::S;
-    }
-
+    size_t stat = weight[(X - 1) * Y + HMMModel::E] >= weight[(X - 1) * Y + HMMModel::S] ? HMMModel::E : HMMModel::S;
     status.resize(X);
     for (int x = X -1 ; x >= 0; x--) {
       status[x] = stat;
-      stat = path[x + stat*X];
+      stat = path[x * Y + stat];
     }
   }
 
   const HMMModel* model_;
   bool isNeedDestroy_;
+  const RuneClassTable& classes_;
+  HMMMemo memo_; // splits of recently decoded pieces
 }; // class HMMSegment
 
 } // namespace cppjieba
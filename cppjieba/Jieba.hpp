@@ -1,11 +1,18 @@
 #ifndef CPPJIEAB_JIEBA_H
 #define CPPJIEAB_JIEBA_H
 
+#include <memory>
+#include <mutex>
 #include "QuerySegment.hpp"
 #include "KeywordExtractor.hpp"
 
 namespace cppjieba {
 
+// Only the dictionaries and the mix segment that Cut uses are built up
+// front. The other segments and the keyword extractor, whose idf and stop
+// word tables are the bulk of its cost, are created on first use, so a
+// program that only calls Cut never pays for them. Creation is guarded by
+// call_once and safe from concurrent const calls.
 class Jieba {
  public:
   Jieba(const string& dict_path = "", 
@@ -15,18 +22,39 @@ class Jieba {
         const string& stop_word_path = "") 
     : dict_trie_(getPath(dict_path, "jieba.dict.utf8"), getPath(user_dict_path, "user.dict.utf8")),
       model_(getPath(model_path, "hmm_model.utf8")),
-      mp_seg_(&dict_trie_),
-      hmm_seg_(&model_),
       mix_seg_(&dict_trie_, &model_),
-      full_seg_(&dict_trie_),
-      query_seg_(&dict_trie_, &model_),
-      extractor(&dict_trie_, &model_, 
-                getPath(idf_path, "idf.utf8"), 
-                getPath(stop_word_path, "stop_words.utf8")) {
+      image_(NULL),
+      idf_path_(getPath(idf_path, "idf.utf8")),
+      stop_word_path_(getPath(stop_word_path, "stop_words.utf8")),
+      hmm_memo_capacity_(0) {
+  }
+  // dictionaries from an image written by SaveImage; the image must outlive
+  // this object
+  explicit Jieba(const DictImage& image)
+    : dict_trie_(image),
+      model_(image),
+      mix_seg_(&dict_trie_, &model_),
+      image_(&image),
+      hmm_memo_capacity_(0) {
   }
   ~Jieba() {
   }
 
+  // compiles the loaded dictionaries into an image; sources are the text
+  // files it was built from, recorded so a stale image can be detected
+  bool SaveImage(const string& path, const vector<string>& sources = vector<string>()) const {
+    DictImageWriter writer;
+    vector<string> fingerprints;
+    for (size_t i = 0; i < sources.size(); i++) {
+      fingerprints.push_back(DictSourceFingerprint(sources[i]));
+    }
+    writer.AddStrings(DictImage::SOURCES, fingerprints);
+    dict_trie_.Save(writer);
+    model_.Save(writer);
+    GetKeywordExtractor().Save(writer);
+    return writer.Write(path);
+  }
+
   struct LocWord {
     string word;
     size_t begin;
@@ -39,29 +67,50 @@ class Jieba {
   void Cut(const string& sentence, vector<Word>& words, bool hmm = true) const {
     mix_seg_.Cut(sentence, words, hmm);
   }
+  void Cut(const string& sentence, vector<WordSpan>& spans, bool hmm = true) const {
+    mix_seg_.Cut(sentence, spans, hmm);
+  }
+  template <class Callback>
+  void CutEach(const string& sentence, Callback callback, bool hmm = true) const {
+    mix_seg_.CutEach(sentence, callback, hmm);
+  }
+  // the same, drawing scratch buffers from a per-thread context
+  void Cut(const string& sentence, vector<string>& words, SegmentContext& ctx, bool hmm = true) const {
+    mix_seg_.Cut(sentence, words, ctx, hmm);
+  }
+  void Cut(const string& sentence, vector<Word>& words, SegmentContext& ctx, bool hmm = true) const {
+    mix_seg_.Cut(sentence, words, ctx, hmm);
+  }
+  void Cut(const string& sentence, vector<WordSpan>& spans, SegmentContext& ctx, bool hmm = true) const {
+    mix_seg_.Cut(sentence, spans, ctx, hmm);
+  }
+  template <class Callback>
+  void CutEach(const string& sentence, Callback callback, SegmentContext& ctx, bool hmm = true) const {
+    mix_seg_.CutEach(sentence, callback, ctx, hmm);
+  }
   void CutAll(const string& sentence, vector<string>& words) const {
-    full_seg_.Cut(sentence, words);
+    FullSeg().Cut(sentence, words);
   }
   void CutAll(const string& sentence, vector<Word>& words) const {
-    full_seg_.Cut(sentence, words);
+    FullSeg().Cut(sentence, words);
   }
   void CutForSearch(const string& sentence, vector<string>& words, bool hmm = true) const {
-    query_seg_.Cut(sentence, words, hmm);
+    QuerySeg().Cut(sentence, words, hmm);
   }
   void CutForSearch(const string& sentence, vector<Word>& words, bool hmm = true) const {
-    query_seg_.Cut(sentence, words, hmm);
+    QuerySeg().Cut(sentence, words, hmm);
   }
   void CutHMM(const string& sentence, vector<string>& words) const {
-    hmm_seg_.Cut(sentence, words);
+    HMMSeg().Cut(sentence, words);
   }
   void CutHMM(const string& sentence, vector<Word>& words) const {
-    hmm_seg_.Cut(sentence, words);
+    HMMSeg().Cut(sentence, words);
   }
   void CutSmall(const string& sentence, vector<string>& words, size_t max_word_len) const {
-    mp_seg_.Cut(sentence, words, max_word_len);
+    MPSeg().Cut(sentence, words, max_word_len);
   }
   void CutSmall(const string& sentence, vector<Word>& words, size_t max_word_len) const {
-    mp_seg_.Cut(sentence, words, max_word_len);
+    MPSeg().Cut(sentence, words, max_word_len);
   }
   
   void Tag(const string& sentence, vector<pair<string, string> >& words) const {
@@ -78,22 +127,62 @@ class Jieba {
     return dict_trie_.InsertUserWord(word,freq, tag);
   }
 
+  bool InsertUserWords(const vector<string>& words, const string& tag = UNKNOWN_TAG) {
+    return dict_trie_.InsertUserWords(words, tag);
+  }
+
   bool DeleteUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
     return dict_trie_.DeleteUserWord(word, tag);
   }
   
+  // changes whenever the dictionary is updated; see DictTrie::Version
+  uint64_t DictVersion() const {
+    return dict_trie_.Version();
+  }
+
   bool Find(const string& word)
   {
     return dict_trie_.Find(word);
   }
 
+  // also applied to segments created later
   void ResetSeparators(const string& s) {
     //TODO
-    mp_seg_.ResetSeparators(s);
-    hmm_seg_.ResetSeparators(s);
+    separators_ = s;
     mix_seg_.ResetSeparators(s);
-    full_seg_.ResetSeparators(s);
-    query_seg_.ResetSeparators(s);
+    if (mp_seg_) {
+      mp_seg_->ResetSeparators(s);
+    }
+    if (hmm_seg_) {
+      hmm_seg_->ResetSeparators(s);
+    }
+    if (full_seg_) {
+      full_seg_->ResetSeparators(s);
+    }
+    if (query_seg_) {
+      query_seg_->ResetSeparators(s);
+    }
+  }
+
+  // pieces each segmenter remembers Viterbi splits for, 0 disables the
+  // memo; not thread safe, call before cutting
+  void SetHMMMemoCapacity(size_t capacity) {
+    hmm_memo_capacity_ = capacity;
+    mix_seg_.SetHMMMemoCapacity(capacity);
+    if (hmm_seg_) {
+      hmm_seg_->SetMemoCapacity(capacity);
+    }
+    if (query_seg_) {
+      query_seg_->SetHMMMemoCapacity(capacity);
+    }
+  }
+
+  const KeywordExtractor& GetKeywordExtractor() const {
+    return Lazy(extractor_, extractor_once_, [this]() {
+      return NULL == image_
+        ? new KeywordExtractor(&dict_trie_, &model_, idf_path_, stop_word_path_)
+        : new KeywordExtractor(&dict_trie_, &model_, *image_);
+    });
   }
 
   const DictTrie* GetDictTrie() const {
@@ -140,6 +229,47 @@ class Jieba {
     return (pos == string::npos) ? "" : path.substr(0, pos);
   }
 
+  // creates a component on first use
+  template <class T, class Factory>
+  static T& Lazy(unique_ptr<T>& component, once_flag& once, Factory create) {
+    call_once(once, [&]() {
+      component.reset(create());
+    });
+    return *component;
+  }
+  // new segments pick up the separators and memo size set so far
+  template <class T>
+  T* Configured(T* seg) const {
+    if (!separators_.empty()) {
+      seg->ResetSeparators(separators_);
+    }
+    return seg;
+  }
+  const MPSegment& MPSeg() const {
+    return Lazy(mp_seg_, mp_seg_once_, [this]() {
+      return Configured(new MPSegment(&dict_trie_));
+    });
+  }
+  const HMMSegment& HMMSeg() const {
+    return Lazy(hmm_seg_, hmm_seg_once_, [this]() -> HMMSegment* {
+      HMMSegment* seg = Configured(new HMMSegment(&model_));
+      seg->SetMemoCapacity(hmm_memo_capacity_);
+      return seg;
+    });
+  }
+  const FullSegment& FullSeg() const {
+    return Lazy(full_seg_, full_seg_once_, [this]() {
+      return Configured(new FullSegment(&dict_trie_));
+    });
+  }
+  const QuerySegment& QuerySeg() const {
+    return Lazy(query_seg_, query_seg_once_, [this]() -> QuerySegment* {
+      QuerySegment* seg = Configured(new QuerySegment(&dict_trie_, &model_));
+      seg->SetHMMMemoCapacity(hmm_memo_capacity_);
+      return seg;
+    });
+  }
+
   static string getPath(const string& path, const string& default_file) {
     if (path.empty()) {
       string current_dir = getCurrentDirectory();
@@ -154,14 +284,24 @@ class Jieba {
   HMMModel model_;
   
   // They share the same dict trie and model
-  MPSegment mp_seg_;
-  HMMSegment hmm_seg_;
   MixSegment mix_seg_;
-  FullSegment full_seg_;
-  QuerySegment query_seg_;
+  mutable unique_ptr<MPSegment> mp_seg_;
+  mutable unique_ptr<HMMSegment> hmm_seg_;
+  mutable unique_ptr<FullSegment> full_seg_;
+  mutable unique_ptr<QuerySegment> query_seg_;
+  mutable unique_ptr<KeywordExtractor> extractor_;
+  mutable once_flag mp_seg_once_;
+  mutable once_flag hmm_seg_once_;
+  mutable once_flag full_seg_once_;
+  mutable once_flag query_seg_once_;
+  mutable once_flag extractor_once_;
 
- public:
-  KeywordExtractor extractor;
+  // what the lazy components are created from
+  const DictImage* image_;
+  string idf_path_;
+  string stop_word_path_;
+  string separators_;
+  size_t hmm_memo_capacity_;
 }; // class Jieba
 
 } // namespace cppjieba
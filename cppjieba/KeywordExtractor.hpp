@@ -34,9 +34,34 @@ class KeywordExtractor {
     LoadIdfDict(idfPath);
     LoadStopWordDict(stopWordPath);
   }
+  KeywordExtractor(const DictTrie* dictTrie, 
+        const HMMModel* model,
+        const DictImage& image) 
+    : segment_(dictTrie, model) {
+    XCHECK(LoadImage(image)) << "invalid keyword image";
+  }
   ~KeywordExtractor() {
   }
 
+  // idf entries are written in word order, so images are reproducible
+  void Save(DictImageWriter& writer) const {
+    std::vector<pair<std::string, double> > idfs(idfMap_.begin(), idfMap_.end());
+    std::sort(idfs.begin(), idfs.end());
+    std::vector<std::string> words(idfs.size());
+    std::vector<double> values(idfs.size());
+    for (size_t i = 0; i < idfs.size(); i++) {
+      words[i] = idfs[i].first;
+      values[i] = idfs[i].second;
+    }
+    std::vector<std::string> stopWords(stopWords_.begin(), stopWords_.end());
+    std::sort(stopWords.begin(), stopWords.end());
+
+    writer.Add(DictImage::IDF_META, &idfAverage_, sizeof(idfAverage_));
+    writer.AddStrings(DictImage::IDF_WORDS, words);
+    writer.AddArray(DictImage::IDF_VALUES, values);
+    writer.AddStrings(DictImage::STOP_WORDS, stopWords);
+  }
+
   void Extract(const std::string& sentence, std::vector<std::string>& keywords, size_t topN) const {
     std::vector<Word> topWords;
     Extract(sentence, topWords, topN);
@@ -119,6 +144,28 @@ class KeywordExtractor {
     idfAverage_ = idfSum / lineno;
     assert(idfAverage_ > 0.0);
   }
+  bool LoadImage(const DictImage& image) {
+    DictImageStrings words;
+    const double* values;
+    size_t valueCount;
+    DictImageStrings stopWords;
+    if (!image.Record(DictImage::IDF_META, idfAverage_) ||
+        !image.Strings(DictImage::IDF_WORDS, words) ||
+        !image.Array(DictImage::IDF_VALUES, values, valueCount) ||
+        !image.Strings(DictImage::STOP_WORDS, stopWords) ||
+        words.size() != valueCount) {
+      XLOG(ERROR) << "keyword sections missing";
+      return false;
+    }
+    idfMap_.reserve(valueCount);
+    for (size_t i = 0; i < valueCount; i++) {
+      idfMap_[words[i]] = values[i];
+    }
+    for (size_t i = 0; i < stopWords.size(); i++) {
+      stopWords_.insert(stopWords[i]);
+    }
+    return true;
+  }
   void LoadStopWordDict(const std::string& filePath) {
     std::ifstream ifs(filePath.c_str());
     XCHECK(ifs.is_open()) << "open " << filePath << " failed";
@@ -40,13 +40,21 @@ class MPSegment: public SegmentTagged {
   void Cut(const string& sentence, 
         vector<Word>& words, 
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    PreFilter pre_filter(symbols_, sentence);
+    SegmentContext ctx;
+    Cut(sentence, words, ctx, max_word_len);
+  }
+  void Cut(const string& sentence, 
+        vector<Word>& words, 
+        SegmentContext& ctx,
+        size_t max_word_len = MAX_WORD_LENGTH) const {
+    PreFilter pre_filter(symbols_, sentence, ctx);
     PreFilter::Range range;
-    vector<WordRange> wrs;
+    vector<WordRange>& wrs = ctx.ranges;
+    wrs.clear();
     wrs.reserve(sentence.size()/2);
     while (pre_filter.HasNext()) {
       range = pre_filter.Next();
-      Cut(range.begin, range.end, wrs, max_word_len);
+      Cut(range.begin, range.end, wrs, ctx, max_word_len);
     }
     words.clear();
     words.reserve(wrs.size());
@@ -56,7 +64,15 @@ class MPSegment: public SegmentTagged {
            RuneStrArray::const_iterator end,
            vector<WordRange>& words,
            size_t max_word_len = MAX_WORD_LENGTH) const {
-    vector<Dag> dags;
+    SegmentContext ctx;
+    Cut(begin, end, words, ctx, max_word_len);
+  }
+  void Cut(RuneStrArray::const_iterator begin,
+           RuneStrArray::const_iterator end,
+           vector<WordRange>& words,
+           SegmentContext& ctx,
+           size_t max_word_len = MAX_WORD_LENGTH) const {
+    vector<Dag>& dags = ctx.dags;
     dictTrie_->Find(begin, 
           end, 
           dags,
@@ -25,35 +25,71 @@ class MixSegment: public SegmentTagged {
     Cut(sentence, words, true);
   }
   void Cut(const string& sentence, vector<string>& words, bool hmm) const {
-    vector<Word> tmp;
-    Cut(sentence, tmp, hmm);
-    GetStringsFromWords(tmp, words);
+    SegmentContext ctx;
+    Cut(sentence, words, ctx, hmm);
   }
-  void Cut(const string& sentence, vector<Word>& words, bool hmm = true) const {
-    PreFilter pre_filter(symbols_, sentence);
-    PreFilter::Range range;
-    vector<WordRange> wrs;
-    wrs.reserve(sentence.size() / 2);
-    while (pre_filter.HasNext()) {
-      range = pre_filter.Next();
-      Cut(range.begin, range.end, wrs, hmm);
+  void Cut(const string& sentence, vector<string>& words, SegmentContext& ctx, bool hmm = true) const {
+    CutRanges(sentence, ctx, hmm, false);
+    words.resize(ctx.ranges.size());
+    for (size_t i = 0; i < ctx.ranges.size(); i++) {
+      WordSpan span = GetSpanFromRunes(ctx.ranges[i].left, ctx.ranges[i].right);
+      words[i].assign(sentence, span.offset, span.len);
     }
+  }
+  void Cut(const string& sentence, vector<Word>& words, bool hmm = true) const {
+    SegmentContext ctx;
+    Cut(sentence, words, ctx, hmm);
+  }
+  void Cut(const string& sentence, vector<Word>& words, SegmentContext& ctx, bool hmm = true) const {
+    CutRanges(sentence, ctx, hmm, true);
     words.clear();
-    words.reserve(wrs.size());
-    GetWordsFromWordRanges(sentence, wrs, words);
+    words.reserve(ctx.ranges.size());
+    GetWordsFromWordRanges(sentence, ctx.ranges, words);
+  }
+  // byte ranges into sentence instead of copied strings
+  void Cut(const string& sentence, vector<WordSpan>& spans, bool hmm = true) const {
+    SegmentContext ctx;
+    Cut(sentence, spans, ctx, hmm);
+  }
+  void Cut(const string& sentence, vector<WordSpan>& spans, SegmentContext& ctx, bool hmm = true) const {
+    spans.clear();
+    CutEach(sentence, [&spans](const char*, size_t, const WordSpan& span) {
+      spans.push_back(span);
+    }, ctx, hmm);
+  }
+  // callback(const char* word, size_t len, const WordSpan& span) is invoked for
+  // every word in order; word points into sentence and is not NUL-terminated
+  template <class Callback>
+  void CutEach(const string& sentence, Callback callback, bool hmm = true) const {
+    SegmentContext ctx;
+    CutEach(sentence, callback, ctx, hmm);
+  }
+  template <class Callback>
+  void CutEach(const string& sentence, Callback callback, SegmentContext& ctx, bool hmm = true) const {
+    CutRanges(sentence, ctx, hmm, false);
+    for (size_t i = 0; i < ctx.ranges.size(); i++) {
+      WordSpan span = GetSpanFromRunes(ctx.ranges[i].left, ctx.ranges[i].right);
+      callback(sentence.data() + span.offset, (size_t)span.len, span);
+    }
   }
 
   void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool hmm) const {
+    SegmentContext ctx;
+    Cut(begin, end, res, ctx, hmm);
+  }
+  void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, SegmentContext& ctx, bool hmm) const {
     if (!hmm) {
-      mpSeg_.Cut(begin, end, res);
+      mpSeg_.Cut(begin, end, res, ctx);
       return;
     }
-    vector<WordRange> words;
+    vector<WordRange>& words = ctx.mpRanges;
+    words.clear();
     assert(end >= begin);
     words.reserve(end - begin);
-    mpSeg_.Cut(begin, end, words);
+    mpSeg_.Cut(begin, end, words, ctx);
 
-    vector<WordRange> hmmRes;
+    vector<WordRange>& hmmRes = ctx.hmmRanges;
+    hmmRes.clear();
     hmmRes.reserve(end - begin);
     for (size_t i = 0; i < words.size(); i++) {
       //if mp Get a word, it's ok, put it into result
@@ -71,7 +107,7 @@ class MixSegment: public SegmentTagged {
       // Cut the sequence with hmm
       assert(j - 1 >= i);
       // TODO
-      hmmSeg_.Cut(words[i].left, words[j - 1].left + 1, hmmRes);
+      hmmSeg_.Cut(words[i].left, words[j - 1].left + 1, hmmRes, ctx);
       //put hmm result to result
       for (size_t k = 0; k < hmmRes.size(); k++) {
         res.push_back(hmmRes[k]);
@@ -89,6 +125,10 @@ class MixSegment: public SegmentTagged {
     return mpSeg_.GetDictTrie();
   }
 
+  void SetHMMMemoCapacity(size_t capacity) {
+    hmmSeg_.SetMemoCapacity(capacity);
+  }
+
   bool Tag(const string& src, vector<pair<string, string> >& res) const {
     return tagger_.Tag(src, res, *this);
   }
@@ -98,6 +138,19 @@ class MixSegment: public SegmentTagged {
   }
 
  private:
+  // words of sentence into ctx.ranges, pointing into ctx.runes; only Word
+  // results need the rune-index fields decoded
+  void CutRanges(const string& sentence, SegmentContext& ctx, bool hmm, bool unicodeOffsets) const {
+    PreFilter pre_filter(symbols_, sentence, ctx, unicodeOffsets);
+    PreFilter::Range range;
+    ctx.ranges.clear();
+    ctx.ranges.reserve(sentence.size() / 2);
+    while (pre_filter.HasNext()) {
+      range = pre_filter.Next();
+      Cut(range.begin, range.end, ctx.ranges, ctx, hmm);
+    }
+  }
+
   MPSegment mpSeg_;
   HMMSegment hmmSeg_;
   PosTagger tagger_;
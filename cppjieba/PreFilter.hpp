@@ -2,6 +2,8 @@
 #define CPPJIEBA_PRE_FILTER_H
 
 #include "Trie.hpp"
+#include "SegmentContext.hpp"
+#include "RuneClass.hpp"
 #include "limonp/Logging.hpp"
 
 namespace cppjieba {
@@ -14,24 +16,36 @@ class PreFilter {
     RuneStrArray::const_iterator end;
   }; // struct Range
 
-  PreFilter(const unordered_set<Rune>& symbols, 
+  PreFilter(const RuneClassTable& symbols, 
         const string& sentence)
-    : symbols_(symbols) {
-    if (!DecodeUTF8RunesInString(sentence, sentence_)) {
-      XLOG(ERROR) << "UTF-8 decode failed for input sentence"; 
-    }
-    cursor_ = sentence_.begin();
+    : sentence_(own_), symbols_(symbols) {
+    Init(sentence, true);
+  }
+  // decode into ctx.runes, which must outlive the ranges, and count repaired
+  // bytes in ctx.malformed; unicodeOffsets as in DecodeUTF8Runes
+  PreFilter(const RuneClassTable& symbols, 
+        const string& sentence,
+        SegmentContext& ctx,
+        bool unicodeOffsets = true)
+    : sentence_(ctx.runes), symbols_(symbols) {
+    Init(sentence, unicodeOffsets);
+    ctx.malformed += repaired_;
   }
   ~PreFilter() {
   }
   bool HasNext() const {
     return cursor_ != sentence_.end();
   }
+  // malformed UTF-8 sequences replaced by U+FFFD; the rest of the sentence
+  // is segmented as usual
+  size_t Repaired() const {
+    return repaired_;
+  }
   Range Next() {
     Range range;
     range.begin = cursor_;
     while (cursor_ != sentence_.end()) {
-      if (IsIn(symbols_, cursor_->rune)) {
+      if (symbols_.Has(cursor_->rune, RUNE_SEPARATOR)) {
         if (range.begin == cursor_) {
           cursor_ ++;
         }
@@ -44,9 +58,16 @@ class PreFilter {
     return range;
   }
  private:
+  void Init(const string& sentence, bool unicodeOffsets) {
+    repaired_ = DecodeUTF8Runes(sentence.data(), sentence.size(), sentence_, unicodeOffsets);
+    cursor_ = sentence_.begin();
+  }
+
   RuneStrArray::const_iterator cursor_;
-  RuneStrArray sentence_;
-  const unordered_set<Rune>& symbols_;
+  RuneStrArray own_;
+  RuneStrArray& sentence_;
+  const RuneClassTable& symbols_;
+  size_t repaired_;
 }; // class PreFilter
 
 } // namespace cppjieba
@@ -33,24 +33,33 @@ class QuerySegment: public SegmentBase {
     GetStringsFromWords(tmp, words);
   }
   void Cut(const string& sentence, vector<Word>& words, bool hmm = true) const {
-    PreFilter pre_filter(symbols_, sentence);
+    SegmentContext ctx;
+    Cut(sentence, words, ctx, hmm);
+  }
+  void Cut(const string& sentence, vector<Word>& words, SegmentContext& ctx, bool hmm = true) const {
+    PreFilter pre_filter(symbols_, sentence, ctx);
     PreFilter::Range range;
-    vector<WordRange> wrs;
+    vector<WordRange>& wrs = ctx.ranges;
+    wrs.clear();
     wrs.reserve(sentence.size()/2);
     while (pre_filter.HasNext()) {
       range = pre_filter.Next();
-      Cut(range.begin, range.end, wrs, hmm);
+      Cut(range.begin, range.end, wrs, ctx, hmm);
     }
     words.clear();
     words.reserve(wrs.size());
     GetWordsFromWordRanges(sentence, wrs, words);
   }
   void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool hmm) const {
+    SegmentContext ctx;
+    Cut(begin, end, res, ctx, hmm);
+  }
+  void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, SegmentContext& ctx, bool hmm) const {
     //use mix Cut first
-    vector<WordRange> mixRes;
-    mixSeg_.Cut(begin, end, mixRes, hmm);
+    vector<WordRange>& mixRes = ctx.mixRanges;
+    mixRes.clear();
+    mixSeg_.Cut(begin, end, mixRes, ctx, hmm);
 
-    vector<WordRange> fullRes;
     for (vector<WordRange>::const_iterator mixResItr = mixRes.begin(); mixResItr != mixRes.end(); mixResItr++) {
       if (mixResItr->Length() > 2) {
         for (size_t i = 0; i + 1 < mixResItr->Length(); i++) {
@@ -71,6 +80,10 @@ class QuerySegment: public SegmentBase {
       res.push_back(*mixResItr);
     }
   }
+  void SetHMMMemoCapacity(size_t capacity) {
+    mixSeg_.SetHMMMemoCapacity(capacity);
+  }
+
  private:
   bool IsAllAscii(const Unicode& s) const {
    for(size_t i = 0; i < s.size(); i++) {
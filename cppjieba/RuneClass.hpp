@@ -0,0 +1,129 @@
+#ifndef CPPJIEBA_RUNE_CLASS_H
+#define CPPJIEBA_RUNE_CLASS_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "Unicode.hpp"
+
+namespace cppjieba {
+
+// classes a rune can belong to, as bits of one byte
+enum RuneClassBit {
+  RUNE_SEPARATOR   = 0x01, // sentence separator of a segmenter
+  RUNE_USER_SINGLE = 0x02, // single-character user dictionary word
+  RUNE_CJK         = 0x04,
+  RUNE_LETTER      = 0x08, // ASCII letter
+  RUNE_DIGIT       = 0x10, // ASCII digit
+  RUNE_PUNCT       = 0x20, // ASCII, CJK and full-width punctuation
+}; // enum RuneClassBit
+
+// Flat classification table: a two-level bitmap over the BMP, 256 pages of
+// 256 class bytes each, where pages without any class share one zero page.
+// A lookup is two indexed loads instead of a hash probe; the few runes
+// outside the BMP that carry a class live in a side map.
+class RuneClassTable {
+ public:
+  static const size_t PAGE_SIZE = 256;
+  static const size_t PAGE_COUNT = 0x10000 / PAGE_SIZE;
+
+  RuneClassTable(): index_(PAGE_COUNT, 0), pages_(PAGE_SIZE, 0) {
+  }
+
+  uint8_t Get(Rune rune) const {
+    if (rune < 0x10000) {
+      return pages_[index_[rune / PAGE_SIZE] * PAGE_SIZE + rune % PAGE_SIZE];
+    }
+    if (extra_.empty()) {
+      return 0;
+    }
+    std::unordered_map<Rune, uint8_t>::const_iterator it = extra_.find(rune);
+    return it == extra_.end() ? 0 : it->second;
+  }
+  bool Has(Rune rune, uint8_t bits) const {
+    return 0 != (Get(rune) & bits);
+  }
+
+  void Set(Rune rune, uint8_t bits) {
+    if (rune < 0x10000) {
+      Cell(rune) |= bits;
+    } else {
+      extra_[rune] |= bits;
+    }
+  }
+  void SetRange(Rune first, Rune last, uint8_t bits) {
+    for (Rune rune = first; rune <= last; rune++) {
+      Set(rune, bits);
+    }
+  }
+  // clears bits on every rune; pages stay allocated
+  void Clear(uint8_t bits) {
+    for (size_t i = 0; i < pages_.size(); i++) {
+      pages_[i] &= uint8_t(~bits);
+    }
+    for (std::unordered_map<Rune, uint8_t>::iterator it = extra_.begin(); it != extra_.end(); ++it) {
+      it->second &= uint8_t(~bits);
+    }
+  }
+  // runes with any of bits, in rune order
+  void Collect(uint8_t bits, std::vector<Rune>& runes) const {
+    for (Rune rune = 0; rune < 0x10000; rune++) {
+      if (Has(rune, bits)) {
+        runes.push_back(rune);
+      }
+    }
+    size_t bmp = runes.size();
+    for (std::unordered_map<Rune, uint8_t>::const_iterator it = extra_.begin(); it != extra_.end(); ++it) {
+      if (it->second & bits) {
+        runes.push_back(it->first);
+      }
+    }
+    std::sort(runes.begin() + bmp, runes.end());
+  }
+
+ private:
+  uint8_t& Cell(Rune rune) {
+    uint16_t& page = index_[rune / PAGE_SIZE];
+    if (0 == page) {
+      page = uint16_t(pages_.size() / PAGE_SIZE);
+      pages_.resize(pages_.size() + PAGE_SIZE, 0);
+    }
+    return pages_[page * PAGE_SIZE + rune % PAGE_SIZE];
+  }
+
+  std::vector<uint16_t> index_; // page of each block of 256 runes, 0 is the zero page
+  std::vector<uint8_t> pages_;
+  std::unordered_map<Rune, uint8_t> extra_;
+}; // class RuneClassTable
+
+// the fixed classes: CJK ideographs, ASCII letters and digits, punctuation
+inline const RuneClassTable& StaticRuneClasses() {
+  struct Builder {
+    static RuneClassTable Build() {
+      RuneClassTable table;
+      table.SetRange(0x3400, 0x4DBF, RUNE_CJK);
+      table.SetRange(0x4E00, 0x9FFF, RUNE_CJK);
+      table.SetRange(0xF900, 0xFAFF, RUNE_CJK);
+      table.SetRange('a', 'z', RUNE_LETTER);
+      table.SetRange('A', 'Z', RUNE_LETTER);
+      table.SetRange('0', '9', RUNE_DIGIT);
+      table.SetRange(0x21, 0x2F, RUNE_PUNCT);
+      table.SetRange(0x3A, 0x40, RUNE_PUNCT);
+      table.SetRange(0x5B, 0x60, RUNE_PUNCT);
+      table.SetRange(0x7B, 0x7E, RUNE_PUNCT);
+      table.SetRange(0x3000, 0x303F, RUNE_PUNCT);
+      table.SetRange(0xFF01, 0xFF0F, RUNE_PUNCT);
+      table.SetRange(0xFF1A, 0xFF20, RUNE_PUNCT);
+      table.SetRange(0xFF3B, 0xFF40, RUNE_PUNCT);
+      table.SetRange(0xFF5B, 0xFF65, RUNE_PUNCT);
+      return table;
+    }
+  };
+  static const RuneClassTable table = Builder::Build();
+  return table;
+}
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_RUNE_CLASS_H
@@ -3,6 +3,7 @@
 
 #include "limonp/Logging.hpp"
 #include "PreFilter.hpp"
+#include "SegmentContext.hpp"
 #include <cassert>
 
 
@@ -23,22 +24,23 @@ class SegmentBase {
   virtual void Cut(const string& sentence, vector<string>& words) const = 0;
 
   bool ResetSeparators(const string& s) {
-    symbols_.clear();
+    symbols_.Clear(RUNE_SEPARATOR);
     RuneStrArray runes;
     if (!DecodeUTF8RunesInString(s, runes)) {
       XLOG(ERROR) << "UTF-8 decode failed for separators: " << s;
       return false;
     }
     for (size_t i = 0; i < runes.size(); i++) {
-      if (!symbols_.insert(runes[i].rune).second) {
+      if (symbols_.Has(runes[i].rune, RUNE_SEPARATOR)) {
         XLOG(ERROR) << s.substr(runes[i].offset, runes[i].len) << " already exists";
         return false;
       }
+      symbols_.Set(runes[i].rune, RUNE_SEPARATOR);
     }
     return true;
   }
  protected:
-  unordered_set<Rune> symbols_;
+  RuneClassTable symbols_; // RUNE_SEPARATOR bits
 }; // class SegmentBase
 
 } // cppjieba
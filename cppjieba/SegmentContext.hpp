@@ -0,0 +1,31 @@
+#ifndef CPPJIEBA_SEGMENT_CONTEXT_H
+#define CPPJIEBA_SEGMENT_CONTEXT_H
+
+#include <vector>
+#include "Unicode.hpp"
+#include "Trie.hpp"
+
+namespace cppjieba {
+
+// Scratch buffers for one chain of Cut calls. Segmenters draw every
+// temporary from here instead of allocating per call, so a context reused
+// across sentences reaches a steady state without mallocs.
+// A context is not thread safe: keep one per thread.
+struct SegmentContext {
+  RuneStrArray runes;            // decoded sentence, see PreFilter
+  vector<WordRange> ranges;      // words of the whole sentence, point into runes
+  vector<WordRange> mpRanges;    // MixSegment: max probability result of one piece
+  vector<WordRange> hmmRanges;   // MixSegment: hmm result of one piece
+  vector<WordRange> mixRanges;   // QuerySegment: mix result of one piece
+  vector<Dag> dags;              // MPSegment, FullSegment
+  vector<size_t> status;         // HMMSegment::Viterbi
+  vector<int> path;
+  vector<double> weight;
+  size_t malformed;              // malformed UTF-8 sequences repaired so far
+  SegmentContext(): malformed(0) {
+  }
+}; // struct SegmentContext
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_SEGMENT_CONTEXT_H
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <queue>
+#include <algorithm>
 #include "limonp/StdExtension.hpp"
 #include "Unicode.hpp"
 
@@ -38,24 +39,63 @@ struct Dag {
 
 typedef Rune TrieKey;
 
-class TrieNode {
- public :
-  TrieNode(): next(NULL), ptValue(NULL) {
+// Flat trie: nodes and edges live in two contiguous arrays. The children of
+// a node are a sorted run of edges [childBegin, childBegin + childCount), so
+// a step is a short scan or binary search instead of a hash lookup through a
+// heap-allocated map. Children of the root, the only wide node, are indexed
+// directly for the BMP. Nodes refer to their word by index, so the arrays
+// hold no pointers and can be saved to and mapped from a dictionary image.
+struct TrieNode {
+  uint32_t childBegin;
+  uint32_t childCount;
+  uint32_t value; // 1 + index into the value table, 0 for none
+  TrieNode(): childBegin(0), childCount(0), value(0) {
   }
- public:
-  typedef unordered_map<TrieKey, TrieNode*> NextMap;
-  NextMap *next;
-  const DictUnit *ptValue;
-};
+}; // struct TrieNode
+
+struct TrieEdge {
+  TrieKey key;
+  uint32_t node;
+  TrieEdge(TrieKey k, uint32_t n): key(k), node(n) {
+  }
+}; // struct TrieEdge
 
 class Trie {
  public:
+  static const uint32_t ROOT = 0;
+  static const uint32_t NONE = 0; // the root is never a child
+  static const size_t ROOT_TABLE_SIZE = 0x10000;
+  static const uint32_t LINEAR_SEARCH_MAX = 8;
+
   Trie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers)
-   : root_(new TrieNode) {
+   : ownNodes_(1), ownRootTable_(ROOT_TABLE_SIZE, NONE) {
     CreateTrie(keys, valuePointers);
+    Attach();
+    BuildAutomaton();
+  }
+  // borrows arrays owned elsewhere, e.g. a mapped dictionary image; they are
+  // copied on the first runtime mutation. fail and output may be NULL, in
+  // which case the DAG is built by walking from every position.
+  Trie(const TrieNode* nodes, size_t nodeCount,
+       const TrieEdge* edges, size_t edgeCount,
+       const uint32_t* rootTable,
+       const uint32_t* fail, const uint32_t* output,
+       const vector<const DictUnit*>& values)
+   : nodes_(nodes), nodeCount_(nodeCount), edges_(edges), edgeCount_(edgeCount),
+     rootTable_(rootTable), fail_(fail), output_(output), values_(values) {
+  }
+  // the starting point of a new version; arrays the original borrows are
+  // still only copied when the copy is first mutated
+  Trie(const Trie& other)
+   : ownNodes_(other.ownNodes_), ownEdges_(other.ownEdges_), ownRootTable_(other.ownRootTable_),
+     ownFail_(other.ownFail_), ownOutput_(other.ownOutput_),
+     nodes_(other.nodes_), nodeCount_(other.nodeCount_), edges_(other.edges_), edgeCount_(other.edgeCount_),
+     rootTable_(other.rootTable_), fail_(other.fail_), output_(other.output_), values_(other.values_) {
+    if (other.nodes_ == other.ownNodes_.data()) {
+      Attach();
+    }
   }
   ~Trie() {
-    DeleteNode(root_);
   }
 
   const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
@@ -63,137 +103,404 @@ class Trie {
       return NULL;
     }
 
-    const TrieNode* ptNode = root_;
-    TrieNode::NextMap::const_iterator citer;
+    uint32_t node = ROOT;
     for (RuneStrArray::const_iterator it = begin; it != end; it++) {
-      if (NULL == ptNode->next) {
+      node = Child(node, it->rune);
+      if (NONE == node) {
         return NULL;
       }
-      citer = ptNode->next->find(it->rune);
-      if (ptNode->next->end() == citer) {
-        return NULL;
-      }
-      ptNode = citer->second;
     }
-    return ptNode->ptValue;
+    return Value(node);
   }
 
+  // Fills res[i].nexts with every dictionary word starting at i, in order of
+  // its end position, after the (i, single rune) entry. With the automaton
+  // in place this is one Aho-Corasick pass: at each position the output
+  // chain lists the words ending there, longest first, and each is appended
+  // to the DAG node of its start.
   void Find(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<struct Dag>&res, 
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    assert(root_ != NULL);
+    if (NULL == fail_) {
+      FindByWalk(begin, end, res, max_word_len);
+      return;
+    }
     res.resize(end - begin);
 
-    const TrieNode *ptNode = NULL;
-    TrieNode::NextMap::const_iterator citer;
-    for (size_t i = 0; i < size_t(end - begin); i++) {
-      res[i].runestr = *(begin + i);
+    uint32_t state = ROOT;
+    for (size_t j = 0; j < size_t(end - begin); j++) {
+      Rune rune = (begin + j)->rune;
+      res[j].runestr = *(begin + j);
+      res[j].nexts.truncate(); // res may be reused scratch space
 
-      if (root_->next != NULL && root_->next->end() != (citer = root_->next->find(res[i].runestr.rune))) {
-        ptNode = citer->second;
-      } else {
-        ptNode = NULL;
+      uint32_t single = Child(ROOT, rune);
+      res[j].nexts.push_back(pair<size_t, const DictUnit*>(j, NONE == single ? NULL : Value(single)));
+
+      uint32_t next = Child(state, rune);
+      while (NONE == next && ROOT != state) {
+        state = fail_[state];
+        next = Child(state, rune);
       }
-      if (ptNode != NULL) {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, ptNode->ptValue));
-      } else {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, static_cast<const DictUnit*>(NULL)));
+      state = next; // NONE is the root
+
+      for (uint32_t node = state; ROOT != node; node = output_[node]) {
+        const DictUnit* unit = Value(node);
+        if (NULL == unit) {
+          continue;
+        }
+        size_t len = unit->word.size();
+        if (len > 1 && len <= max_word_len) {
+          res[j + 1 - len].nexts.push_back(pair<size_t, const DictUnit*>(j, unit));
+        }
       }
+    }
+  }
+
+  // walks forward from every start position; used while the automaton is
+  // stale after runtime insertions
+  void FindByWalk(RuneStrArray::const_iterator begin, 
+        RuneStrArray::const_iterator end, 
+        vector<struct Dag>&res, 
+        size_t max_word_len = MAX_WORD_LENGTH) const {
+    res.resize(end - begin);
+
+    for (size_t i = 0; i < size_t(end - begin); i++) {
+      res[i].runestr = *(begin + i);
+      res[i].nexts.truncate(); // res may be reused scratch space
+
+      uint32_t node = Child(ROOT, res[i].runestr.rune);
+      res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, NONE == node ? NULL : Value(node)));
 
       for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
-        if (ptNode == NULL || ptNode->next == NULL) {
+        if (NONE == node || 0 == nodes_[node].childCount) {
           break;
         }
-        citer = ptNode->next->find((begin + j)->rune);
-        if (ptNode->next->end() == citer) {
+        node = Child(node, (begin + j)->rune);
+        if (NONE == node) {
           break;
         }
-        ptNode = citer->second;
-        if (NULL != ptNode->ptValue) {
-          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, ptNode->ptValue));
+        if (0 != nodes_[node].value) {
+          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, Value(node)));
+        }
+      }
+    }
+  }
+
+  // calls match(first, last, unit) for every word occurring anywhere in
+  // [begin, end), where [first, last] are rune indexes, in no particular
+  // order; one Aho-Corasick pass when the automaton is in place
+  template <class Callback>
+  void Scan(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        Callback match) const {
+    if (NULL == fail_) {
+      for (size_t i = 0; i < size_t(end - begin); i++) {
+        uint32_t node = ROOT;
+        for (size_t j = i; j < size_t(end - begin); j++) {
+          node = Child(node, (begin + j)->rune);
+          if (NONE == node) {
+            break;
+          }
+          if (0 != nodes_[node].value) {
+            match(i, j, Value(node));
+          }
+        }
+      }
+      return;
+    }
+    uint32_t state = ROOT;
+    for (size_t j = 0; j < size_t(end - begin); j++) {
+      Rune rune = (begin + j)->rune;
+      uint32_t next = Child(state, rune);
+      while (NONE == next && ROOT != state) {
+        state = fail_[state];
+        next = Child(state, rune);
+      }
+      state = next;
+      for (uint32_t node = state; ROOT != node; node = output_[node]) {
+        const DictUnit* unit = Value(node);
+        if (NULL != unit) {
+          match(j + 1 - unit->word.size(), j, unit);
         }
       }
     }
   }
 
+  // runtime insertion (user words): a node that gains a child has its edge
+  // run moved to the end of the edge array; the old slots are left unused
   void InsertNode(const Unicode& key, const DictUnit* ptValue) {
     if (key.begin() == key.end()) {
       return;
     }
+    Own();
+    DropAutomaton();
 
-    TrieNode::NextMap::const_iterator kmIter;
-    TrieNode *ptNode = root_;
+    uint32_t node = ROOT;
     for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
-      if (NULL == ptNode->next) {
-        ptNode->next = new TrieNode::NextMap;
-      }
-      kmIter = ptNode->next->find(*citer);
-      if (ptNode->next->end() == kmIter) {
-        TrieNode *nextNode = new TrieNode;
-
-        ptNode->next->insert(make_pair(*citer, nextNode));
-        ptNode = nextNode;
-      } else {
-        ptNode = kmIter->second;
+      uint32_t next = Child(node, *citer);
+      if (NONE == next) {
+        next = AddChild(node, *citer);
       }
+      node = next;
     }
-    assert(ptNode != NULL);
-    ptNode->ptValue = ptValue;
+    values_.push_back(ptValue);
+    ownNodes_[node].value = uint32_t(values_.size());
   }
-  void DeleteNode(const Unicode& key, const DictUnit* ptValue) {
-      if (key.begin() == key.end()) {
+  // removes the word whatever its tag; longer words sharing its prefix are kept
+  void DeleteNode(const Unicode& key) {
+    if (key.begin() == key.end()) {
+      return;
+    }
+
+    uint32_t node = ROOT;
+    for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
+      node = Child(node, *citer);
+      if (NONE == node) {
         return;
       }
-      //定义一个NextMap迭代器
-      TrieNode::NextMap::const_iterator kmIter;
-      //定义一个指向root的TrieNode指针
-      TrieNode *ptNode = root_;
-      for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
-        //链表不存在元素
-        if (NULL == ptNode->next) {
-          return;
-        }
-        kmIter = ptNode->next->find(*citer);
-        //如果map中不存在,跳出循环
-        if (ptNode->next->end() == kmIter) {
-              break;
+    }
+    Own();
+    ownNodes_[node].value = 0;
+  }
+
+  // Aho-Corasick links: fail is the node of the longest proper suffix of a
+  // node's string that is also in the trie; output is the nearest node on
+  // the fail chain holding a word. Insertions invalidate them (Find falls
+  // back to walking) until this is called again; deletions only clear a
+  // value, so the links stay valid.
+  void BuildAutomaton() {
+    Own();
+    ownFail_.assign(nodeCount_, uint32_t(ROOT));
+    ownOutput_.assign(nodeCount_, uint32_t(ROOT));
+    vector<uint32_t> queue;
+    queue.reserve(nodeCount_);
+    queue.push_back(uint32_t(ROOT));
+    for (size_t head = 0; head < queue.size(); head++) {
+      uint32_t node = queue[head];
+      const TrieNode& n = ownNodes_[node];
+      for (uint32_t e = n.childBegin; e < n.childBegin + n.childCount; e++) {
+        uint32_t child = ownEdges_[e].node;
+        TrieKey key = ownEdges_[e].key;
+        uint32_t fail = ROOT;
+        if (ROOT != node) {
+          uint32_t f = ownFail_[node];
+          uint32_t next = Child(f, key);
+          while (NONE == next && ROOT != f) {
+            f = ownFail_[f];
+            next = Child(f, key);
+          }
+          fail = next;
         }
-        //从unordered_map中擦除该项
-        ptNode->next->erase(*citer);
-        //删除该node
-        ptNode = kmIter->second;
-        delete ptNode;
-        break;
+        ownFail_[child] = fail;
+        ownOutput_[child] = 0 != ownNodes_[fail].value ? fail : ownOutput_[fail];
+        queue.push_back(child);
       }
-      return;
- }
+    }
+    Attach();
+  }
+  bool HasAutomaton() const {
+    return NULL != fail_;
+  }
+
+  // the arrays as laid out in memory, for saving to a dictionary image
+  const TrieNode* Nodes() const {
+    return nodes_;
+  }
+  size_t NodeCount() const {
+    return nodeCount_;
+  }
+  const TrieEdge* Edges() const {
+    return edges_;
+  }
+  size_t EdgeCount() const {
+    return edgeCount_;
+  }
+  const uint32_t* RootTable() const {
+    return rootTable_;
+  }
+  const vector<const DictUnit*>& Values() const {
+    return values_;
+  }
+  const uint32_t* Fail() const {
+    return fail_;
+  }
+  const uint32_t* Output() const {
+    return output_;
+  }
+
  private:
+  uint32_t Child(uint32_t node, TrieKey key) const {
+    if (ROOT == node && key < ROOT_TABLE_SIZE) {
+      return rootTable_[key];
+    }
+    const TrieNode& n = nodes_[node];
+    const TrieEdge* first = edges_ + n.childBegin;
+    const TrieEdge* last = first + n.childCount;
+    if (n.childCount <= LINEAR_SEARCH_MAX) {
+      for (; first != last; ++first) {
+        if (first->key == key) {
+          return first->node;
+        }
+      }
+      return NONE;
+    }
+    while (first < last) {
+      const TrieEdge* mid = first + (last - first) / 2;
+      if (mid->key < key) {
+        first = mid + 1;
+      } else {
+        last = mid;
+      }
+    }
+    return (first != edges_ + n.childBegin + n.childCount && first->key == key) ? first->node : NONE;
+  }
+
+  const DictUnit* Value(uint32_t node) const {
+    uint32_t value = nodes_[node].value;
+    return 0 == value ? NULL : values_[value - 1];
+  }
+
+  // points the read path at the owned arrays
+  void Attach() {
+    nodes_ = ownNodes_.data();
+    nodeCount_ = ownNodes_.size();
+    edges_ = ownEdges_.data();
+    edgeCount_ = ownEdges_.size();
+    rootTable_ = ownRootTable_.data();
+    fail_ = ownFail_.empty() ? NULL : ownFail_.data();
+    output_ = ownOutput_.empty() ? NULL : ownOutput_.data();
+  }
+
+  void DropAutomaton() {
+    ownFail_.clear();
+    ownOutput_.clear();
+    fail_ = NULL;
+    output_ = NULL;
+  }
+
+  // copies borrowed arrays before the first mutation
+  void Own() {
+    if (nodes_ != ownNodes_.data()) {
+      ownNodes_.assign(nodes_, nodes_ + nodeCount_);
+      ownEdges_.assign(edges_, edges_ + edgeCount_);
+      ownRootTable_.assign(rootTable_, rootTable_ + ROOT_TABLE_SIZE);
+      if (NULL != fail_) {
+        ownFail_.assign(fail_, fail_ + nodeCount_);
+        ownOutput_.assign(output_, output_ + nodeCount_);
+      }
+      Attach();
+    }
+  }
+
+  uint32_t AddChild(uint32_t node, TrieKey key) {
+    uint32_t child = uint32_t(ownNodes_.size());
+    ownNodes_.push_back(TrieNode());
+
+    TrieNode& n = ownNodes_[node];
+    uint32_t begin = uint32_t(ownEdges_.size());
+    size_t pos = 0;
+    while (pos < n.childCount && ownEdges_[n.childBegin + pos].key < key) {
+      pos++;
+    }
+    for (size_t i = 0; i < n.childCount; i++) {
+      if (i == pos) {
+        ownEdges_.push_back(TrieEdge(key, child));
+      }
+      ownEdges_.push_back(TrieEdge(ownEdges_[n.childBegin + i]));
+    }
+    if (pos == n.childCount) {
+      ownEdges_.push_back(TrieEdge(key, child));
+    }
+    n.childBegin = begin;
+    n.childCount++;
+
+    if (ROOT == node && key < ROOT_TABLE_SIZE) {
+      ownRootTable_[key] = child;
+    }
+    Attach();
+    return child;
+  }
+
+  // builds breadth first over the keys sorted by rune sequence, so every
+  // node's children are laid out in one contiguous, sorted edge run
   void CreateTrie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers) {
     if (valuePointers.empty() || keys.empty()) {
       return;
     }
     assert(keys.size() == valuePointers.size());
+    values_ = valuePointers;
 
-    for (size_t i = 0; i < keys.size(); i++) {
-      InsertNode(keys[i], valuePointers[i]);
+    vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
     }
-  }
+    std::stable_sort(order.begin(), order.end(), KeyLess(keys));
 
-  void DeleteNode(TrieNode* node) {
-    if (NULL == node) {
-      return;
-    }
-    if (NULL != node->next) {
-      for (TrieNode::NextMap::iterator it = node->next->begin(); it != node->next->end(); ++it) {
-        DeleteNode(it->second);
+    struct Pending {
+      uint32_t node;
+      size_t lo;
+      size_t hi;
+      size_t depth;
+    };
+    std::queue<Pending> todo;
+    Pending root = {ROOT, 0, order.size(), 0};
+    todo.push(root);
+    while (!todo.empty()) {
+      Pending cur = todo.front();
+      todo.pop();
+      size_t i = cur.lo;
+      // keys ending here; the last duplicate wins, as with repeated inserts
+      while (i < cur.hi && keys[order[i]].size() == cur.depth) {
+        ownNodes_[cur.node].value = uint32_t(order[i] + 1);
+        i++;
+      }
+      ownNodes_[cur.node].childBegin = uint32_t(ownEdges_.size());
+      while (i < cur.hi) {
+        TrieKey key = keys[order[i]][cur.depth];
+        size_t j = i;
+        while (j < cur.hi && keys[order[j]][cur.depth] == key) {
+          j++;
+        }
+        uint32_t child = uint32_t(ownNodes_.size());
+        ownNodes_.push_back(TrieNode());
+        ownEdges_.push_back(TrieEdge(key, child));
+        ownNodes_[cur.node].childCount++;
+        if (ROOT == cur.node && key < ROOT_TABLE_SIZE) {
+          ownRootTable_[key] = child;
+        }
+        Pending next = {child, i, j, cur.depth + 1};
+        todo.push(next);
+        i = j;
       }
-      delete node->next;
     }
-    delete node;
   }
 
-  TrieNode* root_;
+  struct KeyLess {
+    const vector<Unicode>& keys;
+    explicit KeyLess(const vector<Unicode>& k): keys(k) {
+    }
+    bool operator()(size_t a, size_t b) const {
+      return std::lexicographical_compare(keys[a].begin(), keys[a].end(),
+                                          keys[b].begin(), keys[b].end());
+    }
+  }; // struct KeyLess
+
+  vector<TrieNode> ownNodes_;
+  vector<TrieEdge> ownEdges_;
+  vector<uint32_t> ownRootTable_; // child of the root for BMP runes
+  vector<uint32_t> ownFail_;
+  vector<uint32_t> ownOutput_;
+
+  // read path: the owned arrays or borrowed ones
+  const TrieNode* nodes_;
+  size_t nodeCount_;
+  const TrieEdge* edges_;
+  size_t edgeCount_;
+  const uint32_t* rootTable_;
+  const uint32_t* fail_;
+  const uint32_t* output_;
+  vector<const DictUnit*> values_;
 }; // class Trie
 } // namespace cppjieba
 
@@ -3,10 +3,14 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <vector>
 #include <ostream>
 #include "limonp/LocalVector.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace cppjieba {
 
@@ -15,6 +19,9 @@ using std::vector;
 
 typedef uint32_t Rune;
 
+// stands in for each malformed UTF-8 sequence
+const Rune UTF8_REPLACEMENT_RUNE = 0xFFFD;
+
 struct Word {
   string word;
   uint32_t offset;
@@ -32,6 +39,17 @@ inline std::ostream& operator << (std::ostream& os, const Word& w) {
   return os << "{\"word\": \"" << w.word << "\", \"offset\": " << w.offset << "}";
 }
 
+// byte range [offset, offset + len) of a word inside the source sentence,
+// so callers can look words up without copying them out
+struct WordSpan {
+  uint32_t offset;
+  uint32_t len;
+  WordSpan(): offset(0), len(0) {
+  }
+  WordSpan(uint32_t o, uint32_t l): offset(o), len(l) {
+  }
+}; // struct WordSpan
+
 struct RuneStr {
   Rune rune;
   uint32_t offset;
@@ -139,27 +157,140 @@ inline RuneStrLite DecodeUTF8ToRune(const char* str, size_t len) {
   return rp;
 }
 
-inline bool DecodeUTF8RunesInString(const char* s, size_t len, RuneStrArray& runes) {
-  runes.clear();
-  runes.reserve(len / 2);
-  for (uint32_t i = 0, j = 0; i < len;) {
-    RuneStrLite rp = DecodeUTF8ToRune(s + i, len - i);
-    if (rp.len == 0) {
-      runes.clear();
+// Decodes the non-ASCII sequence at s, rejecting overlong forms, surrogates
+// and code points past U+10FFFF. On malformed input returns false with
+// rp.len covering the maximal subpart to replace: the lead byte and the
+// continuation bytes that were still acceptable, at least one byte.
+inline bool DecodeUTF8Sequence(const uint8_t* s, size_t len, RuneStrLite& rp) {
+  uint8_t lead = s[0];
+  size_t need;
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    need = 1;
+    rp.rune = lead & 0x1F;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    need = 2;
+    rp.rune = lead & 0x0F;
+    lo = lead == 0xE0 ? 0xA0 : lo;
+    hi = lead == 0xED ? 0x9F : hi;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    need = 3;
+    rp.rune = lead & 0x07;
+    lo = lead == 0xF0 ? 0x90 : lo;
+    hi = lead == 0xF4 ? 0x8F : hi;
+  } else {
+    rp = RuneStrLite(UTF8_REPLACEMENT_RUNE, 1);
+    return false;
+  }
+  for (size_t i = 1; i <= need; i++) {
+    if (i >= len || s[i] < lo || s[i] > hi) {
+      rp = RuneStrLite(UTF8_REPLACEMENT_RUNE, uint32_t(i));
       return false;
     }
-    RuneStr x(rp.rune, i, rp.len, j, 1);
-    runes.push_back(x);
-    i += rp.len;
-    ++j;
+    rp.rune = (rp.rune << 6) | (s[i] & 0x3F);
+    lo = 0x80;
+    hi = 0xBF;
   }
+  rp.len = uint32_t(need + 1);
   return true;
 }
 
+// length of the leading run of ASCII bytes, tested 16 (SSE2) or 8 bytes at a time
+inline size_t UTF8AsciiPrefix(const uint8_t* s, size_t len) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i + 8 <= len; i += 8) {
+    uint64_t block;
+    memcpy(&block, s + i, sizeof(block));
+    if (block & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+  while (i < len && s[i] < 0x80) {
+    i++;
+  }
+  return i;
+}
+
+template <bool UnicodeOffsets>
+inline size_t DecodeUTF8RunesImpl(const uint8_t* s, size_t len, RuneStrArray& runes) {
+  runes.truncate();
+  runes.reserve(len); // at most one rune per byte
+  size_t repaired = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < len; n++) {
+    RuneStr& r = runes[n];
+    r.offset = uint32_t(i);
+    if (UnicodeOffsets) {
+      r.unicode_offset = uint32_t(n);
+      r.unicode_length = 1;
+    }
+    uint8_t lead = s[i];
+    if (lead < 0x80) {
+      r.rune = lead;
+      r.len = 1;
+      i++;
+      // the rest of an ASCII run, block-tested
+      size_t end = i + UTF8AsciiPrefix(s + i, len - i);
+      for (; i < end; i++) {
+        RuneStr& a = runes[++n];
+        a.rune = s[i];
+        a.offset = uint32_t(i);
+        a.len = 1;
+        if (UnicodeOffsets) {
+          a.unicode_offset = uint32_t(n);
+          a.unicode_length = 1;
+        }
+      }
+    } else if (lead >= 0xE1 && lead <= 0xEC && i + 2 < len &&
+               (s[i + 1] & 0xC0) == 0x80 && (s[i + 2] & 0xC0) == 0x80) {
+      // three-byte sequences with no range restrictions, most of CJK
+      r.rune = (Rune(lead & 0x0F) << 12) | (Rune(s[i + 1] & 0x3F) << 6) | (s[i + 2] & 0x3F);
+      r.len = 3;
+      i += 3;
+    } else {
+      RuneStrLite rp;
+      if (!DecodeUTF8Sequence(s + i, len - i, rp)) {
+        repaired++;
+      }
+      r.rune = rp.rune;
+      r.len = rp.len;
+      i += rp.len;
+    }
+  }
+  runes.resize(n);
+  return repaired;
+}
+
+// Decodes s into runes and returns the number of malformed sequences, each
+// repaired to one U+FFFD rune spanning the offending bytes, so rune offsets
+// still tile the input. ASCII runs take a block-tested fast path. Callers
+// that never build Word results may pass unicodeOffsets = false to leave
+// unicode_offset/unicode_length unwritten.
+inline size_t DecodeUTF8Runes(const char* s, size_t len, RuneStrArray& runes, bool unicodeOffsets = true) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(s);
+  return unicodeOffsets ? DecodeUTF8RunesImpl<true>(bytes, len, runes)
+                        : DecodeUTF8RunesImpl<false>(bytes, len, runes);
+}
+
+// false when s was not well-formed; runes then hold the repaired decoding
+inline bool DecodeUTF8RunesInString(const char* s, size_t len, RuneStrArray& runes) {
+  return 0 == DecodeUTF8Runes(s, len, runes);
+}
+
 inline bool DecodeUTF8RunesInString(const string& s, RuneStrArray& runes) {
   return DecodeUTF8RunesInString(s.c_str(), s.size(), runes);
 }
 
+// dictionary words and the like: malformed input is rejected, not repaired
 inline bool DecodeUTF8RunesInString(const char* s, size_t len, Unicode& unicode) {
   unicode.clear();
   RuneStrArray runes;
@@ -197,6 +328,12 @@ inline Word GetWordFromRunes(const string& s, RuneStrArray::const_iterator left,
   return Word(s.substr(left->offset, len), left->offset, left->unicode_offset, unicode_length);
 }
 
+// [left, right]
+inline WordSpan GetSpanFromRunes(RuneStrArray::const_iterator left, RuneStrArray::const_iterator right) {
+  assert(right->offset >= left->offset);
+  return WordSpan(left->offset, right->offset - left->offset + right->len);
+}
+
 inline string GetStringFromRunes(const string& s, RuneStrArray::const_iterator left, RuneStrArray::const_iterator right) {
   assert(right->offset >= left->offset);
   uint32_t len = right->offset - left->offset + right->len;
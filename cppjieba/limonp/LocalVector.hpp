@@ -119,6 +119,17 @@ class LocalVector {
     }
     init_();
   }
+  // drop the elements but keep the storage, so a reused vector stops allocating
+  void truncate() {
+    size_ = 0;
+  }
+  // sets the size for elements already written through operator[] after a
+  // reserve; new elements are not initialized (T is copied with memcpy here,
+  // so it is plain data anyway)
+  void resize(size_t size) {
+    reserve(size);
+    size_ = size;
+  }
 };
 
 template <class T>
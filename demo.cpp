@@ -141,7 +141,7 @@ int main(int argc, char* argv[]) {
 
         // ؼʳȡ (TF-IDF)   Word ṹȨ
         std::vector<cppjieba::KeywordExtractor::Word> keywordres;
-        jieba.extractor.Extract(sentence, keywordres, topk);
+        jieba.GetKeywordExtractor().Extract(sentence, keywordres, topk);
         out << "  Keywords(TF-IDF): ";
         for (size_t i = 0; i < keywordres.size(); ++i) {
             if (i) out << ", ";
@@ -151,7 +151,7 @@ int main(int argc, char* argv[]) {
 
         // ؼʳȡ (һӿ)  ֱ pair<string,double>
         std::vector<std::pair<std::string, double>> keywordres2;
-        jieba.extractor.Extract(sentence, keywordres2, topk);
+        jieba.GetKeywordExtractor().Extract(sentence, keywordres2, topk);
         out << "  Keywords2: ";
         for (size_t i = 0; i < keywordres2.size(); ++i) {
             if (i) out << ", ";
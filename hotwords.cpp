@@ -6,12 +6,14 @@
 // ============================================================================
 
 #include "cppjieba/Jieba.hpp"
+#include "cppjieba/limonp/ArgvContext.hpp"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <map>
 #include <set>
 #include <unordered_map>
@@ -19,6 +21,12 @@
 #include <ctime>
 #include <iomanip>
 #include <cstdlib>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 // ============================================================================
 // 核心数据结构定义
@@ -75,13 +83,95 @@ struct Message {
         : timestamp(ts), content(text), isQuery(false), queryK(0) {}
 };
 
+// 词编号 - 词表中的稠密 32 位编号
+typedef uint32_t WordId;
+
+// 词表标记位 - 停用词、敏感词与自定义过滤词的归属
+enum WordFlag : uint8_t {
+    WORD_STOP = 1,
+    WORD_SENSITIVE = 2,
+    WORD_CUSTOM = 4
+};
+
+// 词表 - 首次出现时为每个词分配稠密编号，窗口与历史只处理编号，
+// 字符串仅保存一份，输出时再取回；词表同时记录各词的标记位，
+// 新词在分配编号时查一次词典，此后过滤只需按编号测试标记位
+class WordTable {
+private:
+    std::unordered_map<std::string, WordId> ids;
+    std::vector<const std::string*> words;  // 编号 -> 词（指向 ids 中的键，地址稳定）
+    std::vector<uint8_t> flags;  // 编号 -> 标记位
+    std::unordered_map<std::string, uint8_t> lexicon;  // 停用词等词典：词 -> 标记位
+    std::string key;  // 按字节区间查找时复用的键缓冲
+    
+public:
+    WordId intern(const std::string& word) {
+        auto it = ids.find(word);
+        if (it != ids.end()) return it->second;
+        WordId id = (WordId)words.size();
+        it = ids.insert(std::make_pair(word, id)).first;
+        words.push_back(&it->first);
+        auto entry = lexicon.find(word);
+        // 空词按停用词处理
+        flags.push_back(entry != lexicon.end() ? entry->second : word.empty() ? WORD_STOP : 0);
+        return id;
+    }
+    
+    WordId intern(const char* data, size_t len) {
+        key.assign(data, len);
+        return intern(key);
+    }
+    
+    // 分词结果以 text 中的字节区间给出，已有的词不产生新的字符串
+    void intern(const std::string& text, const std::vector<cppjieba::WordSpan>& spans,
+                std::vector<WordId>& result) {
+        result.clear();
+        result.reserve(spans.size());
+        for (const auto& span : spans) {
+            result.push_back(intern(text.data() + span.offset, span.len));
+        }
+    }
+    
+    // 从每行一词的文件为词加上标记位，已分配编号的词同时更新；返回新标记的词数，文件打不开返回 -1
+    int loadLexicon(const std::string& filename, WordFlag flag) {
+        std::ifstream ifs(filename);
+        if (!ifs.is_open()) return -1;
+        int loaded = 0;
+        std::string word;
+        while (std::getline(ifs, word)) {
+            if (!word.empty() && word.back() == '\r') {
+                word.pop_back();
+            }
+            if (word.empty()) continue;
+            uint8_t& bits = lexicon[word];
+            if (bits & flag) continue;
+            bits |= flag;
+            loaded++;
+            auto it = ids.find(word);
+            if (it != ids.end()) flags[it->second] |= flag;
+        }
+        return loaded;
+    }
+    
+    const std::string& word(WordId id) const { return *words[id]; }
+    bool hasFlag(WordId id, uint8_t mask) const { return (flags[id] & mask) != 0; }
+    // 未分配编号的词也可查询，不在词典中返回 0
+    uint8_t lexiconFlags(const std::string& word) const {
+        auto entry = lexicon.find(word);
+        return entry != lexicon.end() ? entry->second : 0;
+    }
+    size_t size() const { return words.size(); }
+};
+
 // 词频记录 - 用于Top-K堆
 struct WordFreq {
     std::string word;
     int count;
+    WordId id;
+    int error;  // 近似计数的误差上界，精确模式为0
     
-    WordFreq() : word(""), count(0) {}
-    WordFreq(const std::string& w, int c) : word(w), count(c) {}
+    WordFreq() : word(""), count(0), id(0), error(0) {}
+    WordFreq(const std::string& w, int c, WordId i = 0, int e = 0) : word(w), count(c), id(i), error(e) {}
     
     // 小顶堆比较器 - count大的在堆顶
     bool operator<(const WordFreq& other) const {
@@ -90,322 +180,1788 @@ struct WordFreq {
     }
 };
 
+// 增长率（百分比），previousCount 为0时按新词记100%
+inline double growthRate(int previousCount, int currentCount) {
+    if (previousCount == 0) {
+        return currentCount > 0 ? 100.0 : 0.0;
+    }
+    return ((double)(currentCount - previousCount) / previousCount) * 100.0;
+}
+
+// 按增长率降序排序，增长率相同时按词的字典序，limit > 0 时只保留前 limit 项
+inline void sortByRate(std::vector<std::pair<std::string, double>>& words, size_t limit = 0) {
+    size_t n = limit > 0 ? std::min(limit, words.size()) : words.size();
+    std::partial_sort(words.begin(), words.begin() + n, words.end(), 
+                      [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
+                          if (a.second != b.second) return a.second > b.second;
+                          return a.first < b.first;
+                      });
+    words.resize(n);
+}
+
+// 趋势历史 - 趋势只与上一份快照比较，因此只保存最近一次快照（按词编号的非零计数），
+// 保存快照时就地更新，只需处理自上次快照以来变化的词
+class SnapshotHistory {
+public:
+    typedef std::vector<std::pair<WordId, int>> Delta;  // (词编号, 计数)
+    
+    SnapshotHistory() : taken(0) {}
+    
+    // 记录一次新快照，changes 为自上次快照以来计数可能变化的词及其当前计数
+    void record(const Delta& changes) {
+        for (const auto& change : changes) {
+            if (change.second > 0) {
+                latest[change.first] = change.second;
+            } else {
+                latest.erase(change.first);
+            }
+        }
+        taken++;
+    }
+    
+    // 最近一次快照中的计数
+    int count(WordId id) const {
+        auto it = latest.find(id);
+        return it != latest.end() ? it->second : 0;
+    }
+    
+    // 最近一次快照中计数非零的词
+    const std::unordered_map<WordId, int>& latestCounts() const { return latest; }
+    // 累计保存过的快照数
+    size_t size() const { return taken; }
+    
+private:
+    size_t taken;
+    std::unordered_map<WordId, int> latest;  // 最近一次快照
+};
+
 // ============================================================================
-// 滑动窗口管理器 - 核心数据结构（增强版）
+// 计数引擎 - 窗口内词频的统计后端（精确 / 近似），启动时选择
 // ============================================================================
-class SlidingWindow {
+
+// 桶内写入结果 - 写入时间桶后需要同步给各窗口的变化
+struct BucketChange {
+    bool monitored;  // 该词此前未被本桶的高频词集合记录，现已加入
+    bool replaced;  // 高频词集合已满，替换出了 replacedId
+    WordId replacedId;
+    
+    BucketChange() : monitored(false), replaced(false), replacedId(0) {}
+};
+
+// 桶内计数 - 单个时间桶的词频摘要，具体形式由计数引擎决定；
+// 时间桶由多个窗口共享，每次出现只写入一次
+class BucketCounts {
+public:
+    virtual ~BucketCounts() {}
+    virtual void add(WordId id, BucketChange& change) = 0;
+    virtual void clear() = 0;
+};
+
+// 计数引擎接口 - 单个窗口内的词频聚合
+class CountingEngine {
+public:
+    virtual ~CountingEngine() {}
+    
+    virtual BucketCounts* createBucket() const = 0;
+    // 计入一次已写入窗口内时间桶的出现
+    virtual void add(WordId id, const BucketChange& change) = 0;
+    // 将整个时间桶计入窗口 / 从窗口中扣除
+    virtual void addBucket(const BucketCounts& bucket) = 0;
+    virtual void subtract(const BucketCounts& bucket) = 0;
+    
+    virtual std::vector<WordFreq> getTopK(int k) const = 0;
+    // 近似计数已饱和、无法估计时返回 -1
+    virtual int getUniqueWords() const = 0;
+    
+    // 趋势分析：与上一次快照比较
+    virtual void saveSnapshot() = 0;
+    virtual double getTrend(WordId id) const = 0;
+    // 按变化率降序返回，limit > 0 时只返回前 limit 项
+    virtual std::vector<std::pair<std::string, double>> getEmergingWords(double threshold, size_t limit) const = 0;
+    virtual std::vector<std::pair<std::string, double>> getCoolingWords(double threshold, size_t limit) const = 0;
+    
+    virtual std::string describe() const = 0;
+};
+
+// ----------------------------------------------------------------------------
+// 精确计数引擎 - 稀疏增量桶 + 按编号索引的词频 + 增量排行榜
+// ----------------------------------------------------------------------------
+class ExactCounter : public CountingEngine {
 private:
-    int windowSize;  // 窗口大小（秒）
-    std::unordered_map<std::string, int> wordCount;  // 当前窗口内的词频统计
-    std::queue<std::pair<Timestamp, std::vector<std::string>>> messageQueue;  // 消息队列
-    std::set<std::string> stopWords;  // 停用词集合
-    std::set<std::string> sensitiveWords;  // 敏感词集合
-    int totalWords;  // 窗口内总词数
-    Timestamp latestTime;  // 最新时间戳（用于检测乱序）
-    int outOfOrderCount;  // 乱序消息计数
-    int totalMessageCount;  // 总消息数
+    struct Bucket : public BucketCounts {
+        std::unordered_map<WordId, int> deltas;  // 本桶内各词出现次数
+        void add(WordId id, BucketChange& /*change*/) { deltas[id]++; }
+        void clear() { deltas.clear(); }
+    };
+    
+    // 排行榜比较器 - 与 WordFreq::operator< 一致：count 降序，相同时按词的字典序
+    struct RankCompare {
+        const WordTable* table;
+        explicit RankCompare(const WordTable* t) : table(t) {}
+        bool operator()(const std::pair<int, WordId>& a, const std::pair<int, WordId>& b) const {
+            if (a.first != b.first) return a.first > b.first;
+            if (a.second == b.second) return false;
+            return table->word(a.second) < table->word(b.second);
+        }
+    };
     
-    // 历史窗口快照 - 用于趋势分析
-    struct Snapshot {
-        Timestamp timestamp;
-        std::unordered_map<std::string, int> wordCount;
-        int totalWords;
+    // 趋势索引比较器 - 增长率升序；增长率相同时，新兴端（从高端读）与降温端（从低端读）
+    // 读出的顺序都是词的字典序
+    struct TrendCompare {
+        const WordTable* table;
+        explicit TrendCompare(const WordTable* t) : table(t) {}
+        bool operator()(const std::pair<double, WordId>& a, const std::pair<double, WordId>& b) const {
+            if (a.first != b.first) return a.first < b.first;
+            if (a.second == b.second) return false;
+            return a.first > 0 ? table->word(b.second) < table->word(a.second)
+                               : table->word(a.second) < table->word(b.second);
+        }
     };
-    std::vector<Snapshot> history;
+    
+    const WordTable* table;
+    std::vector<int> wordCount;  // 当前窗口内的词频统计，按词编号索引
+    int uniqueWords;  // 窗口内词频大于0的词数
+    std::set<std::pair<int, WordId>, RankCompare> ranking;  // 增量维护的排行榜，Top-K 直接取前K项
+    SnapshotHistory history;  // 上一份窗口快照
+    std::vector<WordId> dirty;  // 自上次快照以来计数变化过的词
+    std::vector<bool> dirtyFlag;  // 按词编号标记是否已在 dirty 中
+    
+    // 趋势索引：相对上次快照的增长率 -> 词，升序；只收录上次快照中出现过的词与新兴新词。
+    // 计数或快照变化的词先记入 trendDirty，查询时批量重新定位，O(变化词数 × log V)
+    mutable std::set<std::pair<double, WordId>, TrendCompare> trendIndex;
+    mutable std::vector<double> trendRate;  // 按词编号：在趋势索引中的增长率
+    mutable std::vector<bool> trendIndexed;  // 按词编号：是否在趋势索引中
+    mutable std::vector<WordId> trendDirty;  // 待重新定位的词
+    mutable std::vector<bool> trendDirtyFlag;
     
 public:
-    SlidingWindow(int winSize = 600) : windowSize(winSize), totalWords(0), 
-                                        latestTime(0, 0, 0), outOfOrderCount(0), totalMessageCount(0) {}
+    explicit ExactCounter(const WordTable* wordTable)
+        : table(wordTable), uniqueWords(0), ranking(RankCompare(wordTable)),
+          trendIndex(TrendCompare(wordTable)) {}
     
-    // 加载停用词
-    void loadStopWords(const std::string& filename) {
-        std::ifstream ifs(filename);
-        if (!ifs.is_open()) {
-            std::cerr << "[WARN] Cannot load stop words from: " << filename << std::endl;
-            return;
+    BucketCounts* createBucket() const { return new Bucket(); }
+    
+    void add(WordId id, const BucketChange& /*change*/) {
+        adjustCount(id, 1);
+    }
+    
+    void addBucket(const BucketCounts& bucket) {
+        for (const auto& pair : static_cast<const Bucket&>(bucket).deltas) {
+            adjustCount(pair.first, pair.second);
         }
-        std::string word;
-        while (std::getline(ifs, word)) {
-            if (!word.empty() && word.back() == '\r') {
-                word.pop_back();
+    }
+    
+    void subtract(const BucketCounts& bucket) {
+        for (const auto& pair : static_cast<const Bucket&>(bucket).deltas) {
+            adjustCount(pair.first, -pair.second);
+        }
+    }
+    
+    // 获取Top-K热词（排行榜已有序，只需取前K项，O(K)）
+    std::vector<WordFreq> getTopK(int k) const {
+        std::vector<WordFreq> result;
+        if (k <= 0) return result;
+        result.reserve(std::min((size_t)k, ranking.size()));
+        for (auto it = ranking.begin(); it != ranking.end() && result.size() < (size_t)k; ++it) {
+            result.push_back(WordFreq(table->word(it->second), it->first, it->second));
+        }
+        return result;
+    }
+    
+    int getUniqueWords() const { return uniqueWords; }
+    
+    // 只记录自上次快照以来变化过的词，O(变化词数)
+    void saveSnapshot() {
+        SnapshotHistory::Delta changes;
+        changes.reserve(dirty.size());
+        for (WordId id : dirty) {
+            changes.push_back(std::make_pair(id, wordCount[id]));
+            dirtyFlag[id] = false;
+        }
+        dirty.clear();
+        history.record(changes);
+        // 上次快照的计数变了，这些词的增长率需要重新计算
+        for (const auto& change : changes) {
+            markTrendDirty(change.first);
+        }
+    }
+    
+    double getTrend(WordId id) const {
+        if (history.size() < 2) return 0.0;
+        // 比较最近两个窗口
+        return growthRate(history.count(id), countOf(wordCount, id));
+    }
+    
+    // 从趋势索引高端取增长率不低于阈值的词；新词（上次为0、本次至少3次）记100%，不受阈值限制
+    std::vector<std::pair<std::string, double>> getEmergingWords(double threshold, size_t limit) const {
+        std::vector<std::pair<std::string, double>> emerging;
+        if (history.size() < 2) return emerging;
+        
+        refreshTrends();
+        double lowest = std::min(threshold, 100.0);
+        for (auto it = trendIndex.rbegin(); it != trendIndex.rend() && it->first >= lowest; ++it) {
+            if (limit > 0 && emerging.size() >= limit) break;
+            if (it->first >= threshold || history.count(it->second) == 0) {
+                emerging.push_back({table->word(it->second), it->first});
+            }
+        }
+        return emerging;
+    }
+    
+    // 从趋势索引低端取下降率不低于阈值的词
+    std::vector<std::pair<std::string, double>> getCoolingWords(double threshold, size_t limit) const {
+        std::vector<std::pair<std::string, double>> cooling;
+        if (history.size() < 2) return cooling;
+        
+        refreshTrends();
+        for (auto it = trendIndex.begin(); it != trendIndex.end() && -it->first >= threshold; ++it) {
+            if (limit > 0 && cooling.size() >= limit) break;
+            cooling.push_back({table->word(it->second), -it->first});
+        }
+        return cooling;
+    }
+    
+    std::string describe() const { return "exact"; }
+    
+private:
+    // 修改词频并同步排行榜：先删除旧记录再插入新记录，O(log V)
+    void adjustCount(WordId id, int delta) {
+        if (id >= wordCount.size()) {
+            wordCount.resize(table->size(), 0);
+            dirtyFlag.resize(table->size(), false);
+        }
+        if (!dirtyFlag[id]) {
+            dirtyFlag[id] = true;
+            dirty.push_back(id);
+        }
+        markTrendDirty(id);
+        int& count = wordCount[id];
+        if (count > 0) {
+            ranking.erase(std::make_pair(count, id));
+        } else {
+            uniqueWords++;
+        }
+        count += delta;
+        if (count > 0) {
+            ranking.insert(std::make_pair(count, id));
+        } else {
+            count = 0;
+            uniqueWords--;
+        }
+    }
+    
+    void markTrendDirty(WordId id) const {
+        if (id >= trendDirtyFlag.size()) {
+            trendDirtyFlag.resize(table->size(), false);
+            trendRate.resize(table->size(), 0.0);
+            trendIndexed.resize(table->size(), false);
+        }
+        if (!trendDirtyFlag[id]) {
+            trendDirtyFlag[id] = true;
+            trendDirty.push_back(id);
+        }
+    }
+    
+    // 按当前计数与上次快照重新定位变化过的词
+    void refreshTrends() const {
+        for (WordId id : trendDirty) {
+            trendDirtyFlag[id] = false;
+            if (trendIndexed[id]) {
+                trendIndex.erase(std::make_pair(trendRate[id], id));
+            }
+            int previousCount = history.count(id);
+            int currentCount = countOf(wordCount, id);
+            trendIndexed[id] = previousCount > 0 || currentCount >= 3;
+            if (trendIndexed[id]) {
+                trendRate[id] = growthRate(previousCount, currentCount);
+                trendIndex.insert(std::make_pair(trendRate[id], id));
+            }
+        }
+        trendDirty.clear();
+    }
+    
+    static int countOf(const std::vector<int>& counts, WordId id) {
+        return id < counts.size() ? counts[id] : 0;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 近似计数引擎 - 每个时间桶一份 Count-Min Sketch + SpaceSaving 高频词集合
+// 窗口 Sketch 为窗口内各桶 Sketch 之和，候选词为各桶 SpaceSaving 集合的并集；
+// 估计值不低于真实值，且以 1 - e^-depth 的概率至多高出 (e / width) * 窗口总词数
+// ----------------------------------------------------------------------------
+class SketchCounter : public CountingEngine {
+private:
+    static const int DEPTH = 4;  // Count-Min 行数
+    static const size_t HEAVY_ENTRY_BYTES = 48;  // SpaceSaving 每项的估算内存
+    static const size_t SATURATION_DIVISOR = 100;  // 空列不足 1/100 时线性计数不再可靠
+    
+    // Count-Min Sketch：DEPTH 行 × width 列计数器
+    struct CountMin {
+        size_t width;
+        std::vector<int> cells;
+        
+        explicit CountMin(size_t w = 0) : width(w), cells(w * DEPTH, 0) {}
+        
+        size_t cell(int row, WordId id) const {
+            static const uint64_t SEEDS[DEPTH] = {
+                0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                0x165667B19E3779F9ULL, 0x27D4EB2F165667C5ULL
+            };
+            uint64_t h = (SEEDS[row] * ((uint64_t)id + 1)) >> 32;
+            return row * width + (size_t)(h % width);
+        }
+        void add(WordId id, int delta) {
+            for (int row = 0; row < DEPTH; ++row) cells[cell(row, id)] += delta;
+        }
+        int estimate(WordId id) const {
+            int result = cells[cell(0, id)];
+            for (int row = 1; row < DEPTH; ++row) result = std::min(result, cells[cell(row, id)]);
+            return result;
+        }
+        void merge(const CountMin& other, int sign) {
+            for (size_t i = 0; i < cells.size(); ++i) cells[i] += sign * other.cells[i];
+        }
+        void clear() { std::fill(cells.begin(), cells.end(), 0); }
+    };
+    
+    // SpaceSaving：最多监控 capacity 个词，满时替换计数最小者
+    struct SpaceSaving {
+        size_t capacity;
+        std::unordered_map<WordId, int> counts;
+        std::set<std::pair<int, WordId>> order;  // 按计数升序，首项为替换对象
+        
+        explicit SpaceSaving(size_t c = 0) : capacity(c) {}
+        
+        // 返回被替换出集合的词，无替换时返回 false
+        bool add(WordId id, WordId& replaced) {
+            auto it = counts.find(id);
+            if (it != counts.end()) {
+                order.erase(std::make_pair(it->second, id));
+                order.insert(std::make_pair(++it->second, id));
+                return false;
+            }
+            int count = 1;
+            bool hasReplaced = false;
+            if (counts.size() >= capacity) {
+                auto minimum = order.begin();
+                replaced = minimum->second;
+                count = minimum->first + 1;
+                counts.erase(replaced);
+                order.erase(minimum);
+                hasReplaced = true;
+            }
+            counts[id] = count;
+            order.insert(std::make_pair(count, id));
+            return hasReplaced;
+        }
+        void clear() {
+            counts.clear();
+            order.clear();
+        }
+    };
+    
+    struct Bucket : public BucketCounts {
+        CountMin sketch;
+        SpaceSaving heavy;
+        int total;
+        Bucket(size_t width, size_t capacity) : sketch(width), heavy(capacity), total(0) {}
+        void add(WordId id, BucketChange& change) {
+            sketch.add(id, 1);
+            total++;
+            change.monitored = heavy.counts.count(id) == 0;
+            change.replaced = heavy.add(id, change.replacedId);
+        }
+        void clear() {
+            sketch.clear();
+            heavy.clear();
+            total = 0;
+        }
+    };
+    
+    const WordTable* table;
+    size_t width;  // Sketch 列数
+    size_t heavyCapacity;  // 每桶 SpaceSaving 容量
+    CountMin window;  // 窗口 Sketch
+    std::unordered_map<WordId, int> candidates;  // 候选词 -> 监控它的窗口内桶数
+    long long total;  // 窗口总词数
+    SnapshotHistory history;  // 上一份快照：候选词估计值
+    
+public:
+    static const size_t DEFAULT_HEAVY_CAPACITY = 64;
+    static const size_t MIN_WIDTH = 1024;  // 更窄时误差上界与被排序的计数同量级
+    static const int BUCKETS_PER_HORIZON = 60;  // 近似计数时保留范围内的时间桶数，与 --bucket 无关
+    
+    // 同一窗口组内所有 Sketch 宽度必须一致，才能按桶相加减
+    SketchCounter(const WordTable* wordTable, size_t sketchWidth, size_t capacity = DEFAULT_HEAVY_CAPACITY)
+        : table(wordTable), width(sketchWidth), heavyCapacity(capacity), window(sketchWidth), total(0) {}
+    
+    // 由内存预算推算 Sketch 宽度：bucketCount 个桶各一份 Sketch 与高频词集合，
+    // 另有 windowCount 份窗口 Sketch；预算容纳不下 MIN_WIDTH 时返回 0
+    static size_t widthForBudget(double memoryMB, size_t bucketCount, size_t windowCount,
+                                 size_t capacity = DEFAULT_HEAVY_CAPACITY) {
+        double bytes = memoryMB * 1024.0 * 1024.0 - (double)(bucketCount * capacity * HEAVY_ENTRY_BYTES);
+        double cellsPerSketch = bytes / (double)(bucketCount + windowCount) / (DEPTH * sizeof(int));
+        return cellsPerSketch >= MIN_WIDTH ? (size_t)cellsPerSketch : 0;
+    }
+    
+    // 容纳 MIN_WIDTH 宽 Sketch 所需的内存（MB）
+    static double requiredMemoryMB(size_t bucketCount, size_t windowCount,
+                                   size_t capacity = DEFAULT_HEAVY_CAPACITY) {
+        double bytes = (double)(bucketCount * capacity * HEAVY_ENTRY_BYTES) +
+                       (double)((bucketCount + windowCount) * MIN_WIDTH * DEPTH * sizeof(int));
+        return bytes / (1024.0 * 1024.0);
+    }
+    
+    BucketCounts* createBucket() const { return new Bucket(width, heavyCapacity); }
+    
+    void add(WordId id, const BucketChange& change) {
+        window.add(id, 1);
+        total++;
+        if (change.replaced) {
+            releaseCandidate(change.replacedId);
+        }
+        if (change.monitored) {
+            candidates[id]++;
+        }
+    }
+    
+    void addBucket(const BucketCounts& counts) {
+        const Bucket& bucket = static_cast<const Bucket&>(counts);
+        window.merge(bucket.sketch, 1);
+        total += bucket.total;
+        for (const auto& pair : bucket.heavy.counts) {
+            candidates[pair.first]++;
+        }
+    }
+    
+    void subtract(const BucketCounts& counts) {
+        const Bucket& bucket = static_cast<const Bucket&>(counts);
+        window.merge(bucket.sketch, -1);
+        total -= bucket.total;
+        for (const auto& pair : bucket.heavy.counts) {
+            releaseCandidate(pair.first);
+        }
+    }
+    
+    // 候选词按窗口 Sketch 估计值排序
+    std::vector<WordFreq> getTopK(int k) const {
+        std::vector<WordFreq> result;
+        if (k <= 0) return result;
+        int error = errorBound();
+        for (const auto& pair : candidates) {
+            int estimate = window.estimate(pair.first);
+            if (estimate > 0) {
+                result.push_back(WordFreq(table->word(pair.first), estimate, pair.first, error));
+            }
+        }
+        size_t n = std::min((size_t)k, result.size());
+        std::partial_sort(result.begin(), result.begin() + n, result.end());
+        result.resize(n);
+        return result;
+    }
+    
+    // 线性计数法：由窗口 Sketch 第一行的空列比例估计不同词数；空列过少时已饱和，返回 -1
+    int getUniqueWords() const {
+        size_t empty = 0;
+        for (size_t i = 0; i < width; ++i) {
+            if (window.cells[i] == 0) empty++;
+        }
+        if (empty * SATURATION_DIVISOR < width) return -1;
+        return (int)std::lround(-(double)width * std::log((double)empty / width));
+    }
+    
+    // 快照只覆盖候选词：当前候选词取估计值，已不再是候选的词记为0
+    void saveSnapshot() {
+        SnapshotHistory::Delta changes;
+        for (const auto& pair : candidates) {
+            changes.push_back(std::make_pair(pair.first, std::max(window.estimate(pair.first), 0)));
+        }
+        for (const auto& pair : history.latestCounts()) {
+            if (candidates.find(pair.first) == candidates.end()) {
+                changes.push_back(std::make_pair(pair.first, 0));
+            }
+        }
+        history.record(changes);
+    }
+    
+    double getTrend(WordId id) const {
+        if (history.size() < 2) return 0.0;
+        return growthRate(history.count(id), window.estimate(id));
+    }
+    
+    // 候选词数量受 Sketch 配置限制，直接扫描后部分排序
+    std::vector<std::pair<std::string, double>> getEmergingWords(double threshold, size_t limit) const {
+        std::vector<std::pair<std::string, double>> emerging;
+        if (history.size() < 2) return emerging;
+        
+        for (const auto& pair : candidates) {
+            int currentCount = window.estimate(pair.first);
+            int previous = history.count(pair.first);
+            if (previous == 0) {
+                if (currentCount >= 3) {
+                    emerging.push_back({table->word(pair.first), 100.0});
+                }
+            } else {
+                double growth = growthRate(previous, currentCount);
+                if (growth >= threshold) {
+                    emerging.push_back({table->word(pair.first), growth});
+                }
+            }
+        }
+        sortByRate(emerging, limit);
+        return emerging;
+    }
+    
+    std::vector<std::pair<std::string, double>> getCoolingWords(double threshold, size_t limit) const {
+        std::vector<std::pair<std::string, double>> cooling;
+        if (history.size() < 2) return cooling;
+        
+        for (const auto& pair : history.latestCounts()) {
+            double decline = -growthRate(pair.second, window.estimate(pair.first));
+            if (decline >= threshold) {
+                cooling.push_back({table->word(pair.first), decline});
+            }
+        }
+        sortByRate(cooling, limit);
+        return cooling;
+    }
+    
+    std::string describe() const {
+        std::ostringstream oss;
+        oss << "sketch (width " << width << " x depth " << DEPTH
+            << ", " << heavyCapacity << " heavy hitters per bucket, epsilon "
+            << std::setprecision(3) << std::exp(1.0) / width
+            << ", delta " << std::exp(-(double)DEPTH) << ")";
+        return oss.str();
+    }
+    
+private:
+    // Count-Min 误差上界：(e / width) * 窗口总词数
+    int errorBound() const {
+        return (int)std::ceil(std::exp(1.0) / width * total);
+    }
+    
+    void releaseCandidate(WordId id) {
+        auto it = candidates.find(id);
+        if (it != candidates.end() && --it->second <= 0) {
+            candidates.erase(it);
+        }
+    }
+};
+
+// 时间桶 - 一个固定时间粒度内的消息统计，词频摘要由计数引擎提供
+struct TimeBucket {
+    int index;  // 桶编号 = 秒数 / 粒度，-1 表示空槽
+    std::unique_ptr<BucketCounts> counts;  // 本桶内词频摘要
+    int wordCount;  // 本桶内词数
+    int messageCount;  // 本桶内消息数
+    
+    TimeBucket() : index(-1), wordCount(0), messageCount(0) {}
+    
+    void clear() {
+        index = -1;
+        if (counts) counts->clear();
+        wordCount = 0;
+        messageCount = 0;
+    }
+};
+
+// ============================================================================
+// 滑动窗口 - 单个窗口大小的词频视图，时间桶由所属窗口组共享
+// ============================================================================
+class SlidingWindow {
+private:
+    std::unique_ptr<CountingEngine> engine;  // 计数引擎
+    int windowSize;  // 窗口大小（秒）
+    int tailIndex;  // 窗口内最早的桶编号，更早的桶均已从本窗口扣除
+    int headIndex;  // 窗口内最新的可见桶编号，更新的桶尚在水位线之后
+    int messagesInWindow;  // 窗口内消息数
+    int totalWords;  // 窗口内总词数
+    
+public:
+    SlidingWindow(CountingEngine* countingEngine, int winSize)
+        : engine(countingEngine), windowSize(winSize), tailIndex(0), headIndex(-1),
+          messagesInWindow(0), totalWords(0) {}
+    
+    // 桶是否在本窗口的可见范围内
+    bool covers(int bucketIndex) const { return bucketIndex >= tailIndex && bucketIndex <= headIndex; }
+    
+    // 一条消息写入了窗口内的时间桶
+    void addMessage() { messagesInWindow++; }
+    
+    // 一个词写入了窗口内的时间桶
+    void addWord(WordId id, const BucketChange& change) {
+        engine->add(id, change);
+        totalWords++;
+    }
+    
+    // 窗口移动到 [firstLive, lastVisible]：滑出的桶整体扣除，新进入可见范围的桶整体计入
+    // （桶内容保存在共享环中）
+    template <class BucketLookup>
+    void advance(int firstLive, int lastVisible, BucketLookup lookup) {
+        if (firstLive < tailIndex) {
+            // 窗口变大：重新计入仍保留在环中的更早的桶
+            for (int index = firstLive; index < std::min(tailIndex, headIndex + 1); ++index) {
+                const TimeBucket* bucket = lookup(index);
+                if (bucket) {
+                    include(*bucket);
+                }
+            }
+            tailIndex = firstLive;
+        } else if (firstLive > tailIndex) {
+            // 只有已计入的桶（不晚于 headIndex）才需要扣除
+            for (int index = tailIndex; index < std::min(firstLive, headIndex + 1); ++index) {
+                const TimeBucket* bucket = lookup(index);
+                if (bucket) {
+                    evict(*bucket);
+                }
             }
-            if (!word.empty()) {
-                stopWords.insert(word);
+            tailIndex = firstLive;
+        }
+        if (lastVisible > headIndex) {
+            for (int index = std::max(headIndex + 1, tailIndex); index <= lastVisible; ++index) {
+                const TimeBucket* bucket = lookup(index);
+                if (bucket) {
+                    include(*bucket);
+                }
             }
+            headIndex = lastVisible;
+        }
+    }
+    
+    // 计入一个时间桶：水位线越过后，暂存的桶整体生效
+    void include(const TimeBucket& bucket) {
+        if (bucket.counts) {
+            engine->addBucket(*bucket.counts);
+        }
+        totalWords += bucket.wordCount;
+        messagesInWindow += bucket.messageCount;
+    }
+    
+    // 淘汰一个时间桶：按桶内摘要整体扣减词频
+    void evict(const TimeBucket& bucket) {
+        if (bucket.counts) {
+            engine->subtract(*bucket.counts);
         }
-        std::cout << "[INFO] Loaded " << stopWords.size() << " stop words." << std::endl;
+        totalWords -= bucket.wordCount;
+        messagesInWindow -= bucket.messageCount;
+    }
+    
+    // 获取Top-K热词
+    std::vector<WordFreq> getTopK(int k) const {
+        return engine->getTopK(k);
+    }
+    
+    // 保存当前窗口快照
+    void saveSnapshot(const Timestamp& /*ts*/) {
+        engine->saveSnapshot();
+    }
+    
+    // 获取词频趋势（增长率）
+    double getTrend(WordId id) const {
+        return engine->getTrend(id);
+    }
+    
+    // 获取窗口统计信息
+    void printStatistics() const {
+        std::cout << "[STAT] Total unique words: " << uniqueWordsText() 
+                  << ", Total words: " << totalWords 
+                  << ", Messages in window: " << messagesInWindow << std::endl;
+    }
+    
+    // 获取新兴热词（增长率超过阈值）
+    std::vector<std::pair<std::string, double>> getEmergingWords(double threshold = 50.0, size_t limit = 0) const {
+        return engine->getEmergingWords(threshold, limit);
+    }
+    
+    // 获取降温热词（下降率超过阈值）
+    std::vector<std::pair<std::string, double>> getCoolingWords(double threshold = 30.0, size_t limit = 0) const {
+        return engine->getCoolingWords(threshold, limit);
+    }
+    
+    int getTotalWords() const { return totalWords; }
+    int getUniqueWords() const { return engine->getUniqueWords(); }
+    // 唯一词数的输出形式：近似计数饱和时不给出数值
+    std::string uniqueWordsText() const {
+        int unique = getUniqueWords();
+        return unique >= 0 ? std::to_string(unique) : "无法估计（线性计数已饱和）";
+    }
+    int getMessagesInWindow() const { return messagesInWindow; }
+    int getWindowSize() const { return windowSize; }
+    void setWindowSize(int size) { windowSize = size; }
+    std::string getEngineName() const { return engine->describe(); }
+    const CountingEngine& getEngine() const { return *engine; }
+};
+
+// ============================================================================
+// 窗口组 - 多个窗口大小共享一次分词与同一组时间桶（增强版）
+// ============================================================================
+class WindowGroup {
+private:
+    const WordTable* table;  // 共享词表
+    int bucketSeconds;  // 时间桶粒度（秒）
+    std::vector<std::unique_ptr<SlidingWindow>> windows;  // 各窗口视图
+    std::vector<TimeBucket> ring;  // 时间桶环形数组，槽位 = 桶编号 % 容量，覆盖保留范围
+    int horizon;  // 时间桶保留范围（秒），窗口最大可调整到此大小
+    int tailIndex;  // 保留范围内最早的桶编号
+    int lastVisibleIndex;  // 当前水位线下最新的可见桶编号
+    int allowedLateness;  // 水位线允许的迟到秒数，小于0表示不启用水位线
+    int lateDroppedCount;  // 迟到超出水位线（未启用时为落在所有窗口外）而被丢弃的消息数
+    uint8_t filterMask;  // 不计入窗口的词表标记位
+    Timestamp latestTime;  // 最新时间戳（用于检测乱序）
+    int outOfOrderCount;  // 乱序消息计数
+    int totalMessageCount;  // 总消息数
+    double requiredSketchMB;  // 近似计数预算不足时所需的内存，否则为0
+    
+public:
+    // sketchMemoryMB > 0 时使用近似计数引擎，否则精确计数；
+    // lateness >= 0 时启用水位线：水位线 = 最新事件时间 - lateness，
+    // 窗口只反映水位线之前的数据，更早到达的迟到消息被丢弃；
+    // retention 为时间桶保留范围，不足最大窗口时取最大窗口。
+    // 近似计数时每个时间桶各有一份 Sketch，桶粒度放大到保留范围约 BUCKETS_PER_HORIZON 个桶，
+    // 内存用于 Sketch 宽度而非桶数；预算容纳不下时不创建窗口，见 sketchBudgetFits
+    WindowGroup(const WordTable* wordTable, const std::vector<int>& windowSizes,
+                int bucketSec = 1, double sketchMemoryMB = 0, int lateness = -1, int retention = 0)
+        : table(wordTable), bucketSeconds(bucketSec > 0 ? bucketSec : 1), horizon(retention),
+          tailIndex(0), lastVisibleIndex(-1), allowedLateness(lateness), lateDroppedCount(0),
+          filterMask(WORD_STOP | WORD_SENSITIVE | WORD_CUSTOM), latestTime(0, 0, 0), outOfOrderCount(0), totalMessageCount(0),
+          requiredSketchMB(0) {
+        for (int size : windowSizes) {
+            horizon = std::max(horizon, size);
+        }
+        if (sketchMemoryMB > 0) {
+            int perHorizon = SketchCounter::BUCKETS_PER_HORIZON;
+            bucketSeconds = std::max(bucketSeconds, (horizon + perHorizon - 1) / perHorizon);
+        }
+        // 环需要同时容纳保留范围与水位线之后暂存的桶
+        ring.resize(ringCapacity(horizon + std::max(allowedLateness, 0)));
+        
+        size_t sketchWidth = 0;
+        if (sketchMemoryMB > 0) {
+            sketchWidth = SketchCounter::widthForBudget(sketchMemoryMB, ring.size(), windowSizes.size());
+            if (sketchWidth == 0) {
+                requiredSketchMB = SketchCounter::requiredMemoryMB(ring.size(), windowSizes.size());
+                return;
+            }
+        }
+        for (int size : windowSizes) {
+            CountingEngine* engine = sketchWidth > 0
+                ? static_cast<CountingEngine*>(new SketchCounter(wordTable, sketchWidth))
+                : static_cast<CountingEngine*>(new ExactCounter(wordTable));
+            windows.push_back(std::unique_ptr<SlidingWindow>(new SlidingWindow(engine, size)));
+        }
+    }
+    
+    // 添加消息：只写入一次时间桶，再同步给仍覆盖该桶的各窗口
+    void addMessage(const Timestamp& ts, const std::vector<WordId>& words) {
+        totalMessageCount++;
+        
+        // 检测乱序
+        if (ts < latestTime) {
+            outOfOrderCount++;
+        } else {
+            latestTime = ts;
+        }
+        
+        // 推进水位线：淘汰过期桶，计入越过水位线的暂存桶
+        removeExpiredMessages(latestTime);
+        
+        int seconds = ts.toSeconds();
+        int index = seconds / bucketSeconds;
+        bool late = allowedLateness >= 0 ? seconds < getWatermark() : index < tailIndex;
+        if (late) {
+            // 迟到超出水位线，或所属时间桶已滑出所有窗口，直接丢弃
+            lateDroppedCount++;
+            return;
+        }
+        
+        TimeBucket& bucket = ring[index % ring.size()];
+        if (bucket.index != index) {
+            // 槽位上的旧桶早于所有窗口起点，已被各窗口扣除
+            bucket.clear();
+            bucket.index = index;
+        }
+        if (!bucket.counts) {
+            bucket.counts.reset(windows.front()->getEngine().createBucket());
+        }
+        bucket.messageCount++;
+        for (auto& window : windows) {
+            if (window->covers(index)) window->addMessage();
+        }
+        
+        // 过滤停用词、敏感词和自定义过滤词，计入所属时间桶
+        for (WordId id : words) {
+            if (isFiltered(id)) continue;
+            BucketChange change;
+            bucket.counts->add(id, change);
+            bucket.wordCount++;
+            for (auto& window : windows) {
+                if (window->covers(index)) window->addWord(id, change);
+            }
+        }
+    }
+    
+    // 移除过期消息：各窗口以水位线为当前时间，按自身大小整桶淘汰
+    void removeExpiredMessages(const Timestamp& currentTime) {
+        int watermark = currentTime.toSeconds() - std::max(allowedLateness, 0);
+        // 启用水位线时只有完整落在水位线之前的桶可见，否则最新的桶即可见
+        int lastVisible = allowedLateness >= 0 ? floorDiv(watermark + 1, bucketSeconds) - 1
+                                               : floorDiv(watermark, bucketSeconds);
+        advanceWindows(watermark, lastVisible);
+    }
+    
+    // 数据流结束：水位线推进到最新事件时间，暂存的桶全部生效
+    void flush() {
+        advanceWindows(latestTime.toSeconds(), latestTime.toSeconds() / bucketSeconds);
+    }
+    
+    // 调整第 i 个窗口的大小（不超过保留范围）：保留的桶立即整体计入或扣除，无需重读输入
+    int resizeWindow(size_t i, int newSize) {
+        newSize = std::max(0, std::min(newSize, horizon));
+        SlidingWindow& window = *windows[i];
+        window.setWindowSize(newSize);
+        int firstLive = std::max(firstLiveIndex(getWatermark(), newSize), tailIndex);
+        window.advance(firstLive, lastVisibleIndex, [this](int index) { return find(index); });
+        return newSize;
+    }
+    
+    // 当前水位线（秒）：查询结果反映此时刻之前的数据
+    int getWatermark() const {
+        return latestTime.toSeconds() - std::max(allowedLateness, 0);
+    }
+    
+    size_t size() const { return windows.size(); }
+    SlidingWindow& operator[](size_t i) { return *windows[i]; }
+    const SlidingWindow& operator[](size_t i) const { return *windows[i]; }
+    
+    int getOutOfOrderCount() const { return outOfOrderCount; }
+    int getLateDroppedCount() const { return lateDroppedCount; }
+    int getAllowedLateness() const { return allowedLateness; }
+    int getBucketSeconds() const { return bucketSeconds; }
+    bool sketchBudgetFits() const { return requiredSketchMB == 0; }
+    double getRequiredSketchMB() const { return requiredSketchMB; }
+    int getHorizon() const { return horizon; }
+    int getTotalMessageCount() const { return totalMessageCount; }
+    double getOutOfOrderRate() const { 
+        return totalMessageCount > 0 ? (double)outOfOrderCount / totalMessageCount * 100.0 : 0.0; 
+    }
+    
+private:
+    // 环容量：窗口最多跨越 windowSize / bucketSeconds + 2 个桶
+    size_t ringCapacity(int winSize) const {
+        return (size_t)(std::max(winSize, 0) / bucketSeconds + 2);
+    }
+    
+    static int floorDiv(int a, int b) {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+    
+    // 窗口起点所在的桶编号
+    int firstLiveIndex(int watermark, int winSize) const {
+        int windowStart = watermark - winSize;
+        return windowStart >= 0 ? windowStart / bucketSeconds : 0;
+    }
+    
+    // 各窗口移动到以 watermark 为当前时间、lastVisible 为最新可见桶的位置；
+    // 保留范围随之推进，更早的桶可被覆盖
+    void advanceWindows(int watermark, int lastVisible) {
+        for (auto& window : windows) {
+            int firstLive = firstLiveIndex(watermark, window->getWindowSize());
+            window->advance(firstLive, lastVisible, [this](int index) { return find(index); });
+        }
+        tailIndex = std::max(tailIndex, firstLiveIndex(watermark, horizon));
+        lastVisibleIndex = std::max(lastVisibleIndex, lastVisible);
+    }
+    
+    const TimeBucket* find(int index) const {
+        const TimeBucket& bucket = ring[index % ring.size()];
+        return bucket.index == index ? &bucket : NULL;
+    }
+    
+    // 停用词/敏感词/自定义过滤词判定：词表中的标记位
+    bool isFiltered(WordId id) const {
+        return table->hasFlag(id, filterMask);
+    }
+};
+
+// ============================================================================
+// 工具函数
+// ============================================================================
+
+// 解析时间戳 [H:MM:SS] 或 [H:M:S]
+bool parseTimestamp(const std::string& line, Timestamp& ts, std::string& content) {
+    if (line.empty() || line[0] != '[') return false;
+    
+    size_t endBracket = line.find(']');
+    if (endBracket == std::string::npos) return false;
+    
+    std::string timeStr = line.substr(1, endBracket - 1);
+    
+    // 解析时间
+    int h = 0, m = 0, s = 0;
+    char colon1, colon2;
+    std::istringstream iss(timeStr);
+    
+    if (!(iss >> h >> colon1 >> m >> colon2 >> s)) {
+        return false;
+    }
+    
+    ts = Timestamp(h, m, s);
+    
+    // 提取内容
+    if (endBracket + 2 < line.length()) {
+        content = line.substr(endBracket + 2);
+    } else {
+        content = "";
+    }
+    
+    return true;
+}
+
+// 解析QUERY命令
+bool parseQuery(const std::string& content, int& k) {
+    if (content.find("[ACTION]") != std::string::npos && 
+        content.find("QUERY") != std::string::npos) {
+        size_t kPos = content.find("K=");
+        if (kPos != std::string::npos) {
+            std::string kStr = content.substr(kPos + 2);
+            k = std::atoi(kStr.c_str());
+            return true;
+        }
+    }
+    return false;
+}
+
+// 解析RESIZE命令：[ACTION] RESIZE W=秒数 [N=窗口序号]，未给出序号时调整所有窗口
+bool parseResize(const std::string& content, int& windowSize, int& windowNo) {
+    if (content.find("[ACTION]") != std::string::npos && 
+        content.find("RESIZE") != std::string::npos) {
+        size_t wPos = content.find("W=");
+        if (wPos != std::string::npos) {
+            windowSize = std::atoi(content.c_str() + wPos + 2);
+            size_t nPos = content.find("N=");
+            windowNo = nPos != std::string::npos ? std::atoi(content.c_str() + nPos + 2) : 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 输出一次查询结果：Top-K 热词（含趋势）、新兴热词与降温热词
+void writeQueryResult(std::ostream& ofs, const SlidingWindow& window, int k, int queryCount) {
+    auto topK = window.getTopK(k);
+    for (size_t i = 0; i < topK.size(); ++i) {
+        ofs << "  " << (i+1) << ". " << topK[i].word 
+            << " (出现 " << topK[i].count << " 次)";
+        if (topK[i].error > 0) {
+            ofs << " [误差≤" << topK[i].error << "]";
+        }
+        
+        // 添加趋势信息
+        double trend = window.getTrend(topK[i].id);
+        if (trend > 0) {
+            ofs << " ↑" << std::fixed << std::setprecision(1) << trend << "%";
+        } else if (trend < 0) {
+            ofs << " ↓" << std::fixed << std::setprecision(1) << (-trend) << "%";
+        }
+        ofs << std::endl;
+    }
+    
+    // 显示新兴热词
+    auto emerging = window.getEmergingWords(50.0, 3);
+    if (!emerging.empty() && queryCount > 1) {
+        ofs << "\n  📈 新兴热词 (增长率>50%):" << std::endl;
+        for (size_t i = 0; i < std::min(emerging.size(), (size_t)3); ++i) {
+            ofs << "    • " << emerging[i].first << " (+" 
+                << std::fixed << std::setprecision(1) << emerging[i].second << "%)" << std::endl;
+        }
+    }
+    
+    // 显示降温热词
+    auto cooling = window.getCoolingWords(30.0, 3);
+    if (!cooling.empty() && queryCount > 1) {
+        ofs << "  📉 降温热词 (下降率>30%):" << std::endl;
+        for (size_t i = 0; i < std::min(cooling.size(), (size_t)3); ++i) {
+            ofs << "    • " << cooling[i].first << " (-" 
+                << std::fixed << std::setprecision(1) << cooling[i].second << "%)" << std::endl;
+        }
+    }
+    
+    ofs << std::endl;
+}
+
+// 由输出文件名派生各窗口的输出文件：output.txt -> output_300s.txt
+std::string windowOutputFile(const std::string& outputFile, int windowSize) {
+    size_t dot = outputFile.find_last_of('.');
+    size_t slash = outputFile.find_last_of("/\\");
+    std::string suffix = "_" + std::to_string(windowSize) + "s";
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return outputFile + suffix;
+    }
+    return outputFile.substr(0, dot) + suffix + outputFile.substr(dot);
+}
+
+// 敏感词处理策略
+enum SensitivePolicy {
+    SENSITIVE_DROP_TOKEN,  // 只过滤恰好分出敏感词的词（默认，词表标记位）
+    SENSITIVE_MASK_SPAN,   // 屏蔽消息中命中的片段，其余内容照常分词
+    SENSITIVE_DROP_MESSAGE // 命中任一敏感词的消息不计入统计
+};
+
+// 敏感词扫描器 - 用敏感词表构建 Aho-Corasick 自动机（复用分词词典的前缀树），
+// 在分词前对原始内容做一次线性扫描，被分词切开的敏感短语也能命中；
+// 构建后只读，可在多个分词线程中并发使用
+class SensitiveScanner {
+private:
+    std::vector<cppjieba::DictUnit> units;  // 各敏感词，前缀树中的值指向这里
+    std::unique_ptr<cppjieba::Trie> trie;
+    
+public:
+    // 每行一个敏感词；文件打不开返回 false
+    bool load(const std::string& filename) {
+        std::ifstream ifs(filename);
+        if (!ifs.is_open()) return false;
+        std::set<std::string> words;
+        std::string word;
+        while (std::getline(ifs, word)) {
+            if (!word.empty() && word.back() == '\r') {
+                word.pop_back();
+            }
+            if (!word.empty()) words.insert(word);
+        }
+        units.clear();
+        units.reserve(words.size());
+        std::vector<cppjieba::Unicode> keys;
+        for (const auto& w : words) {
+            cppjieba::DictUnit unit;
+            if (!cppjieba::DecodeUTF8RunesInString(w, unit.word)) continue;
+            unit.weight = 0;
+            units.push_back(unit);
+            keys.push_back(unit.word);
+        }
+        std::vector<const cppjieba::DictUnit*> values;
+        for (const auto& unit : units) {
+            values.push_back(&unit);
+        }
+        trie.reset(new cppjieba::Trie(keys, values));
+        return true;
+    }
+    
+    size_t size() const { return units.size(); }
+    
+    // 命中的字节区间 [first, second)，按起点排序并合并重叠部分；runes 为调用方的解码缓冲
+    void scan(const std::string& text, cppjieba::RuneStrArray& runes,
+              std::vector<std::pair<size_t, size_t>>& matches) const {
+        matches.clear();
+        if (!trie || units.empty()) return;
+        cppjieba::DecodeUTF8Runes(text.data(), text.size(), runes, false);
+        trie->Scan(runes.begin(), runes.end(), [&](size_t first, size_t last, const cppjieba::DictUnit*) {
+            matches.push_back(std::make_pair((size_t)runes[first].offset,
+                                             (size_t)(runes[last].offset + runes[last].len)));
+        });
+        if (matches.size() < 2) return;
+        std::sort(matches.begin(), matches.end());
+        size_t merged = 0;
+        for (size_t i = 1; i < matches.size(); ++i) {
+            if (matches[i].first <= matches[merged].second) {
+                matches[merged].second = std::max(matches[merged].second, matches[i].second);
+            } else {
+                matches[++merged] = matches[i];
+            }
+        }
+        matches.resize(merged + 1);
+    }
+};
+
+// 分词结果缓存 - 弹幕中大量消息逐字重复（"先登！"、"我来迟否！"），按消息内容缓存分词得到的
+// 字节区间，命中时跳过分词。键是原文而非规范化后的内容：全角数字、连续全角空格等写法
+// 折叠后分词结果不同，共用条目会改变输出。按内容哈希分成 SHARD_COUNT 个分片，各自加锁，
+// 多个分词线程可共享；每个分片容量固定，满后用 CLOCK（二次机会）算法淘汰最近未被命中的条目。
+// 条目记录分词时的词典版本，词典更新后旧条目不再命中
+class SegmentCache {
+public:
+    static const size_t SHARD_COUNT = 16;
+    static const size_t MAX_CONTENT_BYTES = 256;  // 更长的消息很少重复，不缓存，也限制了内存
+    
+    explicit SegmentCache(size_t capacity) : shards(SHARD_COUNT) {
+        size_t perShard = std::max((capacity + SHARD_COUNT - 1) / SHARD_COUNT, (size_t)1);
+        for (auto& shard : shards) {
+            shard.slots.resize(perShard);
+        }
+    }
+    
+    // 命中且条目由 version 版本的词典切分时填写 spans 与 malformed
+    bool lookup(const std::string& content, uint64_t version, std::vector<cppjieba::WordSpan>& spans,
+                size_t& malformed) {
+        if (content.size() > MAX_CONTENT_BYTES) return false;
+        size_t hash = std::hash<std::string>()(content);
+        Shard& shard = shards[hash % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lookups++;
+        auto it = shard.index.find(hash);
+        if (it == shard.index.end()) return false;
+        Entry& entry = shard.slots[it->second];
+        if (entry.content != content) return false;  // 哈希冲突
+        if (entry.version != version) return false;  // 词典已更新
+        entry.referenced = true;
+        spans.assign(entry.spans.begin(), entry.spans.end());
+        malformed = entry.malformed;
+        shard.hits++;
+        return true;
+    }
+    
+    // version 为切分前读到的词典版本
+    void insert(const std::string& content, uint64_t version, const std::vector<cppjieba::WordSpan>& spans,
+                size_t malformed) {
+        if (content.size() > MAX_CONTENT_BYTES) return;
+        size_t hash = std::hash<std::string>()(content);
+        Shard& shard = shards[hash % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size_t slot;
+        auto it = shard.index.find(hash);
+        if (it != shard.index.end()) {
+            slot = it->second;  // 另一线程已插入、条目已过期，或哈希冲突时覆盖
+        } else {
+            // CLOCK：指针扫过的条目若近期被命中则清除标记、再给一次机会
+            while (shard.slots[shard.hand].used && shard.slots[shard.hand].referenced) {
+                shard.slots[shard.hand].referenced = false;
+                shard.hand = (shard.hand + 1) % shard.slots.size();
+            }
+            slot = shard.hand;
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+            if (shard.slots[slot].used) {
+                shard.index.erase(shard.slots[slot].hash);
+            }
+            shard.index[hash] = slot;
+        }
+        Entry& entry = shard.slots[slot];
+        entry.hash = hash;
+        entry.content = content;
+        entry.version = version;
+        entry.spans.assign(spans.begin(), spans.end());
+        entry.malformed = malformed;
+        entry.used = true;
+        entry.referenced = false;
+    }
+    
+    size_t getLookups() const { return sum(&Shard::lookups); }
+    size_t getHits() const { return sum(&Shard::hits); }
+    double getHitRate() const {
+        size_t lookups = getLookups();
+        return lookups > 0 ? 100.0 * getHits() / lookups : 0.0;
+    }
+    
+private:
+    struct Entry {
+        size_t hash;
+        std::string content;
+        uint64_t version;  // 切分时的词典版本
+        std::vector<cppjieba::WordSpan> spans;
+        size_t malformed;
+        bool used;
+        bool referenced;  // 上次被指针扫过后是否命中过
+        Entry() : hash(0), version(0), malformed(0), used(false), referenced(false) {}
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::vector<Entry> slots;
+        std::unordered_map<size_t, size_t> index;  // 内容哈希 -> 槽位
+        size_t hand;
+        size_t lookups;
+        size_t hits;
+        Shard() : hand(0), lookups(0), hits(0) {}
+    };
+    
+    size_t sum(size_t Shard::*counter) const {
+        size_t total = 0;
+        for (const auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.*counter;
+        }
+        return total;
+    }
+    
+    std::vector<Shard> shards;
+};
+
+// 新词发现 - 弹幕里的新梗、人名（"塞斯黑"）不在分词词典中，常被 HMM 切成单字，既稀释了热词计数，
+// 又反复走慢速的 Viterbi 解码。本组件从窗口内分词结果的连续单字串（未登录的汉字片段）中挖掘
+// 2 ~ MAX_GRAM 字的候选词，逐条消息增量维护候选词频次与左右邻字分布，消息滑出窗口时按记录扣除；
+// 查询时按频次、凝固度（各切分点点互信息的最小值）与左右邻字熵（自由度）评分，
+// 通过阈值的词由调用方加入分词词典，之后的消息即按整词切分
+class NewWordDiscovery {
+public:
+    static const size_t MAX_GRAM = 4;  // 候选词最大字数
+
+    // 一个通过评分的新词
+    struct Candidate {
+        std::string word;
+        int count;  // 窗口内频次
+        double pmi;  // 凝固度
+        double leftEntropy;  // 左邻字熵
+        double rightEntropy;  // 右邻字熵
+    };
+
+    NewWordDiscovery(int windowSec, int minimumCount = 5, double minimumPMI = 3.0, double minimumEntropy = 1.0)
+        : windowSeconds(std::max(windowSec, 1)), minCount(std::max(minimumCount, 2)), minPMI(minimumPMI),
+          minEntropy(minimumEntropy), latestSeconds(0), totalChars(0) {}
+
+    // 记录一条消息的单字串；content 为消息内容，spans 为其分词结果
+    void addMessage(const Timestamp& ts, const std::string& content, const std::vector<cppjieba::WordSpan>& spans) {
+        int seconds = ts.toSeconds();
+        if (seconds > latestSeconds) {
+            latestSeconds = seconds;
+            expire();
+        }
+        if (seconds <= latestSeconds - windowSeconds) return;  // 乱序到达且已滑出窗口
+
+        cppjieba::DecodeUTF8Runes(content.data(), content.size(), runes, false);
+        const cppjieba::RuneClassTable& classes = cppjieba::StaticRuneClasses();
+        Record record;
+        size_t runBegin = 0, runEnd = 0;  // 当前单字串 [runBegin, runEnd)，以字下标计
+        size_t r = 0;
+        for (const auto& span : spans) {
+            while (r < runes.size() && runes[r].offset < span.offset) r++;
+            bool single = r < runes.size() && runes[r].offset == span.offset && runes[r].len == span.len &&
+                          classes.Has(runes[r].rune, cppjieba::RUNE_CJK);
+            if (single && runEnd > runBegin && r == runEnd) {
+                runEnd++;
+                continue;
+            }
+            addRun(content, runBegin, runEnd, record);
+            runBegin = single ? r : 0;
+            runEnd = single ? r + 1 : 0;
+        }
+        addRun(content, runBegin, runEnd, record);
+        if (!record.chars.empty()) {
+            records.insert(std::make_pair(seconds, std::move(record)));
+        }
+    }
+
+    // 评分窗口内的候选词，返回新通过阈值的词（按频次降序）；accept 可再否决候选，
+    // 通过的词记为已发现，之后不再报告
+    template <class Predicate>
+    std::vector<Candidate> discover(Predicate accept) {
+        std::vector<Candidate> found;
+        for (const auto& entry : grams) {
+            const Gram& gram = entry.second;
+            if (gram.count < minCount || discovered.count(entry.first)) continue;
+            Candidate candidate;
+            candidate.word = entry.first;
+            candidate.count = gram.count;
+            candidate.pmi = cohesion(entry.first, gram.count);
+            candidate.leftEntropy = gram.left.entropy();
+            candidate.rightEntropy = gram.right.entropy();
+            if (candidate.pmi < minPMI || candidate.leftEntropy < minEntropy ||
+                candidate.rightEntropy < minEntropy || !accept(candidate.word)) {
+                continue;
+            }
+            found.push_back(candidate);
+        }
+        std::sort(found.begin(), found.end(), [](const Candidate& a, const Candidate& b) {
+            return a.count != b.count ? a.count > b.count : a.word < b.word;
+        });
+        for (const auto& candidate : found) {
+            discovered.insert(candidate.word);
+        }
+        return found;
+    }
+
+    size_t getDiscoveredCount() const { return discovered.size(); }
+
+    // 首字与末字的字节数
+    static size_t firstCharLength(const std::string& word) { return cutPoint(word, 0); }
+    static size_t lastCharLength(const std::string& word) {
+        size_t i = word.size();
+        while (i > 0 && ((unsigned char)word[i - 1] & 0xC0) == 0x80) i--;
+        return word.size() - (i > 0 ? i - 1 : 0);
+    }
+
+private:
+    static const cppjieba::Rune BOUNDARY = 0;  // 消息首尾：每次出现都视为不同的邻字
+
+    // 邻字分布：只维护整数计数，熵在查询时由计数求出，滑动窗口中反复加减的浮点累加值会逐渐漂移
+    struct Neighbours {
+        std::unordered_map<cppjieba::Rune, int> counts;
+        int total;
+        Neighbours() : total(0) {}
+
+        void add(cppjieba::Rune rune, int delta) {
+            total += delta;
+            if (rune == BOUNDARY) return;  // 各不相同，c ln c = 0
+            int& c = counts[rune];
+            c += delta;
+            if (c == 0) counts.erase(rune);
+        }
+        // H = ln T - Σ c ln c / T
+        double entropy() const {
+            if (total <= 0) return 0.0;
+            double sumCLogC = 0.0;
+            for (const auto& entry : counts) {
+                sumCLogC += entry.second * std::log((double)entry.second);
+            }
+            return std::max(std::log((double)total) - sumCLogC / total, 0.0);
+        }
+    };
+    struct Gram {
+        int count;
+        Neighbours left;
+        Neighbours right;
+        Gram() : count(0) {}
+    };
+    // 一次出现，消息滑出窗口时据此扣除
+    struct Occurrence {
+        std::string word;
+        cppjieba::Rune left;
+        cppjieba::Rune right;
+    };
+    struct Record {
+        std::vector<std::string> chars;  // 单字串中的各字
+        std::vector<Occurrence> occurrences;  // 2 字及以上的片段
+    };
+
+    // 记录单字串 [begin, end) 中的各字与全部 2 ~ MAX_GRAM 字片段
+    void addRun(const std::string& content, size_t begin, size_t end, Record& record) {
+        if (end - begin < 2) return;
+        for (size_t i = begin; i < end; ++i) {
+            std::string ch = content.substr(runes[i].offset, runes[i].len);
+            charCounts[ch]++;
+            totalChars++;
+            record.chars.push_back(std::move(ch));
+            for (size_t n = 2; n <= MAX_GRAM && i + n <= end; ++n) {
+                const cppjieba::RuneStr& last = runes[i + n - 1];
+                Occurrence occurrence;
+                occurrence.word = content.substr(runes[i].offset, last.offset + last.len - runes[i].offset);
+                occurrence.left = i > 0 ? runes[i - 1].rune : BOUNDARY;
+                occurrence.right = i + n < runes.size() ? runes[i + n].rune : BOUNDARY;
+                apply(occurrence, 1);
+                record.occurrences.push_back(std::move(occurrence));
+            }
+        }
+    }
+
+    void apply(const Occurrence& occurrence, int delta) {
+        Gram& gram = grams[occurrence.word];
+        gram.count += delta;
+        gram.left.add(occurrence.left, delta);
+        gram.right.add(occurrence.right, delta);
+        if (gram.count == 0) grams.erase(occurrence.word);
+    }
+
+    // 早于窗口起点的消息整体扣除
+    void expire() {
+        while (!records.empty() && records.begin()->first <= latestSeconds - windowSeconds) {
+            Record& record = records.begin()->second;
+            for (const auto& ch : record.chars) {
+                if (--charCounts[ch] == 0) charCounts.erase(ch);
+                totalChars--;
+            }
+            for (const auto& occurrence : record.occurrences) {
+                apply(occurrence, -1);
+            }
+            records.erase(records.begin());
+        }
+    }
+
+    // 凝固度：min over 切分点 ln(f(w)·N / (f(a)·f(b)))，N 为单字串中的总字数
+    double cohesion(const std::string& word, int count) const {
+        double best = HUGE_VAL;
+        for (size_t split = cutPoint(word, 0); split < word.size(); split = cutPoint(word, split)) {
+            double a = frequency(word.substr(0, split));
+            double b = frequency(word.substr(split));
+            if (a <= 0 || b <= 0) continue;
+            best = std::min(best, std::log((double)count * totalChars / (a * b)));
+        }
+        return best == HUGE_VAL ? 0.0 : best;
+    }
+
+    // 子串的频次：单字查字频，多字查候选词频次
+    double frequency(const std::string& piece) const {
+        auto ch = charCounts.find(piece);
+        if (ch != charCounts.end()) return ch->second;
+        auto gram = grams.find(piece);
+        return gram != grams.end() ? gram->second.count : 0;
+    }
+
+    // from 之后下一个 UTF-8 字符边界
+    static size_t cutPoint(const std::string& word, size_t from) {
+        size_t i = from + 1;
+        while (i < word.size() && ((unsigned char)word[i] & 0xC0) == 0x80) i++;
+        return i;
+    }
+
+    int windowSeconds;  // 统计窗口（秒）
+    int minCount;  // 频次阈值
+    double minPMI;  // 凝固度阈值
+    double minEntropy;  // 左右邻字熵阈值
+    int latestSeconds;  // 最新消息时间
+    std::unordered_map<std::string, Gram> grams;  // 候选词 -> 计数
+    std::unordered_map<std::string, int> charCounts;  // 单字串中的字频
+    long long totalChars;
+    std::multimap<int, Record> records;  // 窗口内各消息的记录，按时间排序
+    std::set<std::string> discovered;  // 已报告的新词
+    cppjieba::RuneStrArray runes;  // 解码缓冲（跨消息复用）
+};
+
+const cppjieba::Rune NewWordDiscovery::BOUNDARY;  // 在条件表达式中按左值使用，需要定义
+
+// 输出本次查询新发现的词及其评分
+void writeDiscoveredWords(std::ostream& ofs, const std::vector<NewWordDiscovery::Candidate>& words) {
+    if (words.empty()) return;
+    ofs << "  🆕 新词发现 (已加入分词词典):" << std::endl;
+    for (const auto& w : words) {
+        ofs << "    ◦ " << w.word << " (频次 " << w.count << ", 凝固度 " << std::fixed << std::setprecision(2)
+            << w.pmi << ", 左熵 " << w.leftEntropy << ", 右熵 " << w.rightEntropy << ")" << std::endl;
+    }
+    ofs << std::endl;
+}
+
+// 输出最终统计与最终 Top-20
+void writeFinalStatistics(std::ostream& ofs, const WindowGroup& group, const SlidingWindow& window,
+                          int lineCount, int queryCount, bool sketch, const SegmentCache* cache,
+                          int sensitiveMessages, const NewWordDiscovery* discovery) {
+    ofs << "\n===== 最终统计 =====" << std::endl;
+    ofs << "处理的总行数: " << lineCount << std::endl;
+    ofs << "处理的消息数: " << group.getTotalMessageCount() << std::endl;
+    ofs << "查询次数: " << queryCount << std::endl;
+    ofs << "窗口大小: " << window.getWindowSize() << " 秒 (" << (window.getWindowSize()/60) << " 分钟)" << std::endl;
+    ofs << "窗口内唯一词数: " << window.uniqueWordsText() << std::endl;
+    ofs << "窗口内总词数: " << window.getTotalWords() << std::endl;
+    ofs << "乱序消息数: " << group.getOutOfOrderCount() 
+        << " (" << std::fixed << std::setprecision(2) << group.getOutOfOrderRate() << "%)" << std::endl;
+    if (group.getAllowedLateness() >= 0) {
+        ofs << "水位线允许迟到: " << group.getAllowedLateness() << " 秒" << std::endl;
+        ofs << "超出水位线丢弃的消息数: " << group.getLateDroppedCount() << std::endl;
+    }
+    if (sketch) {
+        ofs << "计数引擎: " << window.getEngineName() << std::endl;
+    }
+    if (cache) {
+        ofs << "分词缓存命中率: " << std::fixed << std::setprecision(2) << cache->getHitRate() << "% (命中 "
+            << cache->getHits() << " / 查询 " << cache->getLookups() << ")" << std::endl;
+    }
+    if (sensitiveMessages >= 0) {
+        ofs << "命中敏感词的消息数: " << sensitiveMessages << std::endl;
+    }
+    if (discovery) {
+        ofs << "发现的新词数: " << discovery->getDiscoveredCount() << std::endl;
+    }
+    
+    // 输出最终Top-20
+    ofs << "\n===== 最终 Top-20 热词 =====" << std::endl;
+    auto finalTop = window.getTopK(20);
+    for (size_t i = 0; i < finalTop.size(); ++i) {
+        ofs << "  " << (i+1) << ". " << finalTop[i].word 
+            << " (出现 " << finalTop[i].count << " 次)";
+        if (finalTop[i].error > 0) {
+            ofs << " [误差≤" << finalTop[i].error << "]";
+        }
+        ofs << std::endl;
+    }
+    
+    ofs << "\n===== 分析完成 =====" << std::endl;
+}
+
+// ============================================================================
+// 输入流水线 - 读取 → 并发解析与分词 → 按输入顺序更新窗口
+// ============================================================================
+
+// 输入行 - 一行输入的解析与分词结果
+struct InputLine {
+    int number;  // 行号（从1开始）
+    std::string text;  // 原始行（已去掉行尾 \r）
+    bool hasTimestamp;
+    Timestamp ts;
+    std::string content;  // 时间戳之后的内容
+    bool isQuery;  // [ACTION] QUERY 命令
+    int k;
+    bool isResize;  // [ACTION] RESIZE 命令
+    int newSize;
+    int windowNo;
+    std::vector<cppjieba::WordSpan> spans;  // 分词结果（content 中的字节区间），只对带时间戳的消息行填写
+    size_t malformed;  // 内容中修复为 U+FFFD 的非法 UTF-8 序列数
+    std::vector<std::pair<size_t, size_t>> sensitiveSpans;  // 命中敏感词的字节区间（仅在扫描策略下填写）
+    bool dropped;  // 命中敏感词、按 drop 策略整条丢弃，不进入窗口与消息计数
+    uint64_t dictVersion;  // 分词前读到的词典版本，与当前版本不同时分词结果已过期
+    
+    InputLine() : number(0), hasTimestamp(false), isQuery(false), k(0),
+                  isResize(false), newSize(0), windowNo(0), malformed(0), dropped(false), dictVersion(0) {}
+};
+
+// 屏蔽命中片段后分词：敏感片段作为边界，两侧内容分别分词，区间仍指向原内容
+void cutAroundMatches(const cppjieba::Jieba& jieba, cppjieba::SegmentContext& context, const std::string& content,
+                      const std::vector<std::pair<size_t, size_t>>& matches,
+                      std::vector<cppjieba::WordSpan>& spans) {
+    spans.clear();
+    std::string piece;
+    std::vector<cppjieba::WordSpan> pieceSpans;
+    size_t begin = 0;
+    for (size_t i = 0; i <= matches.size(); ++i) {
+        size_t end = i < matches.size() ? matches[i].first : content.size();
+        if (end > begin) {
+            piece.assign(content, begin, end - begin);
+            jieba.Cut(piece, pieceSpans, context, true);
+            for (auto span : pieceSpans) {
+                span.offset += begin;
+                spans.push_back(span);
+            }
+        }
+        if (i < matches.size()) begin = matches[i].second;
+    }
+}
+
+// 解析一行输入并对消息内容分词；Jieba::Cut 为 const，可在多个线程中并发调用，
+// 分词的临时缓冲取自调用线程自己的 context；cache 非空时先查分词缓存；
+// scanner 非空时按 policy 在分词前处理命中敏感词的内容
+void prepareLine(const cppjieba::Jieba& jieba, cppjieba::SegmentContext& context, InputLine& input,
+                 SegmentCache* cache, const SensitiveScanner* scanner, SensitivePolicy policy) {
+    // 移除Windows换行符
+    if (!input.text.empty() && input.text.back() == '\r') {
+        input.text.pop_back();
     }
+    input.spans.clear();
+    input.malformed = 0;
+    input.sensitiveSpans.clear();
+    input.dropped = false;
+    input.isQuery = input.isResize = false;
+    input.hasTimestamp = false;
+    // 先读版本再分词：分词期间词典若有更新，结果记在旧版本下，之后按过期处理
+    input.dictVersion = jieba.DictVersion();
+    if (input.text.empty()) return;
     
-    // 加载敏感词
-    void loadSensitiveWords(const std::string& filename) {
-        std::ifstream ifs(filename);
-        if (!ifs.is_open()) {
-            std::cerr << "[WARN] Cannot load sensitive words from: " << filename << std::endl;
+    input.hasTimestamp = parseTimestamp(input.text, input.ts, input.content);
+    // 不带时间戳的行整行作为命令
+    const std::string& command = input.hasTimestamp ? input.content : input.text;
+    input.isQuery = parseQuery(command, input.k);
+    if (input.isQuery) return;
+    input.isResize = parseResize(command, input.newSize, input.windowNo);
+    if (input.isResize || !input.hasTimestamp) return;
+    
+    std::vector<std::pair<size_t, size_t>>& matches = input.sensitiveSpans;
+    if (scanner && policy != SENSITIVE_DROP_TOKEN) {
+        scanner->scan(input.content, context.runes, matches);
+        if (!matches.empty() && policy == SENSITIVE_DROP_MESSAGE) {
+            input.dropped = true;
             return;
         }
-        std::string word;
-        while (std::getline(ifs, word)) {
-            if (!word.empty() && word.back() == '\r') {
-                word.pop_back();
-            }
-            if (!word.empty()) {
-                sensitiveWords.insert(word);
-            }
-        }
-        std::cout << "[INFO] Loaded " << sensitiveWords.size() << " sensitive words." << std::endl;
     }
+    if (cache && cache->lookup(input.content, input.dictVersion, input.spans, input.malformed)) return;
     
-    // 添加消息到窗口（支持乱序检测）
-    void addMessage(const Timestamp& ts, const std::vector<std::string>& words) {
-        totalMessageCount++;
-        
-        // 检测乱序
-        if (ts < latestTime) {
-            outOfOrderCount++;
-        } else {
-            latestTime = ts;
-        }
-        
-        // 过滤停用词和敏感词
-        std::vector<std::string> filteredWords;
-        for (const auto& word : words) {
-            if (stopWords.find(word) == stopWords.end() && 
-                sensitiveWords.find(word) == sensitiveWords.end() &&
-                word.length() > 0) {
-                filteredWords.push_back(word);
-                wordCount[word]++;
-                totalWords++;
-            }
-        }
-        
-        // 加入队列
-        messageQueue.push({ts, filteredWords});
-        
-        // 移除过期消息
-        removeExpiredMessages(ts);
+    size_t malformedBefore = context.malformed;
+    if (matches.empty()) {
+        jieba.Cut(input.content, input.spans, context, true);
+    } else {
+        cutAroundMatches(jieba, context, input.content, matches, input.spans);
+    }
+    input.malformed = context.malformed - malformedBefore;
+    // 非法字节被修复为 U+FFFD 后单独成词，其余内容照常分词；这些词不计入统计
+    if (input.malformed > 0) {
+        cppjieba::RuneStrArray& runes = context.runes;
+        auto isMalformed = [&](const cppjieba::WordSpan& span) {
+            return cppjieba::DecodeUTF8Runes(input.content.data() + span.offset, span.len, runes, false) > 0;
+        };
+        input.spans.erase(std::remove_if(input.spans.begin(), input.spans.end(), isMalformed),
+                          input.spans.end());
     }
+    if (cache) cache->insert(input.content, input.dictVersion, input.spans, input.malformed);
+}
+
+// 有界阻塞队列 - 流水线各阶段之间按批传递数据，队列满时生产者等待（背压）
+template <class T>
+class BoundedQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
     
-    // 移除过期消息
-    void removeExpiredMessages(const Timestamp& currentTime) {
-        int currentSeconds = currentTime.toSeconds();
-        int windowStart = currentSeconds - windowSize;
-        
-        while (!messageQueue.empty()) {
-            const auto& front = messageQueue.front();
-            if (front.first.toSeconds() < windowStart) {
-                // 从词频统计中移除
-                for (const auto& word : front.second) {
-                    auto it = wordCount.find(word);
-                    if (it != wordCount.end()) {
-                        it->second--;
-                        totalWords--;
-                        if (it->second <= 0) {
-                            wordCount.erase(it);
-                        }
-                    }
-                }
-                messageQueue.pop();
-            } else {
-                break;
-            }
-        }
+public:
+    explicit BoundedQueue(size_t cap) : capacity(std::max(cap, (size_t)1)), closed(false) {}
+    
+    void push(T&& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
     }
     
-    // 获取Top-K热词
-    std::vector<WordFreq> getTopK(int k) const {
-        std::vector<WordFreq> result;
-        for (const auto& pair : wordCount) {
-            result.push_back(WordFreq(pair.first, pair.second));
-        }
-        
-        // 排序
-        std::sort(result.begin(), result.end());
-        
-        // 取前K个
-        if (result.size() > (size_t)k) {
-            result.resize(k);
-        }
-        
-        return result;
+    // 队列满时不等待，返回 false
+    bool tryPush(T&& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() >= capacity) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
     }
     
-    // 保存当前窗口快照
-    void saveSnapshot(const Timestamp& ts) {
-        Snapshot snap;
-        snap.timestamp = ts;
-        snap.wordCount = wordCount;
-        snap.totalWords = totalWords;
-        history.push_back(snap);
+    // 队列为空时不等待，返回 false
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
     }
     
-    // 获取词频趋势（增长率）
-    double getTrend(const std::string& word) const {
-        if (history.size() < 2) return 0.0;
-        
-        // 比较最近两个窗口
-        const auto& current = wordCount;
-        const auto& previous = history.back().wordCount;
-        
-        int currentCount = 0;
-        int previousCount = 0;
-        
-        auto it1 = current.find(word);
-        if (it1 != current.end()) currentCount = it1->second;
-        
-        auto it2 = previous.find(word);
-        if (it2 != previous.end()) previousCount = it2->second;
-        
-        if (previousCount == 0) {
-            return currentCount > 0 ? 100.0 : 0.0;
-        }
-        
-        return ((double)(currentCount - previousCount) / previousCount) * 100.0;
+    // 队列已关闭且为空时返回 false
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
     }
     
-    // 获取窗口统计信息
-    void printStatistics() const {
-        std::cout << "[STAT] Total unique words: " << wordCount.size() 
-                  << ", Total words: " << totalWords 
-                  << ", Messages in window: " << messageQueue.size() << std::endl;
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
     }
+};
+
+// 输入流水线 - 读取线程按批读入行，workerCount 个分词线程共享同一个 Jieba 并发处理，
+// 调用线程按批次序号重排后逐行交给 handle，处理顺序与输入顺序一致；
+// workerCount <= 1 时在调用线程内串行完成。
+// 每个分词线程持有自己的 SegmentContext，处理完的批次回收给读取线程复用，
+// 稳定后行缓冲与分词缓冲都不再重新分配
+class IngestPipeline {
+public:
+    static const size_t DEFAULT_BATCH_SIZE = 256;
     
-    // 获取新兴热词（增长率超过阈值）
-    std::vector<std::pair<std::string, double>> getEmergingWords(double threshold = 50.0) const {
-        std::vector<std::pair<std::string, double>> emerging;
-        
-        if (history.size() < 2) return emerging;
+    IngestPipeline(const cppjieba::Jieba& segmenter, size_t workerCount,
+                   SegmentCache* segmentCache = NULL, const SensitiveScanner* sensitiveScanner = NULL,
+                   SensitivePolicy sensitivePolicy = SENSITIVE_DROP_TOKEN,
+                   size_t batchLines = DEFAULT_BATCH_SIZE)
+        : jieba(segmenter), cache(segmentCache), scanner(sensitiveScanner), policy(sensitivePolicy),
+          workers(workerCount), batchSize(std::max(batchLines, (size_t)1)) {}
+    
+    template <class Handler>
+    void run(std::istream& input, Handler handle) const {
+        if (workers <= 1) {
+            cppjieba::SegmentContext context;
+            InputLine line;  // 跨行复用
+            while (std::getline(input, line.text)) {
+                line.number++;
+                prepareLine(jieba, context, line, cache, scanner, policy);
+                handle(line);
+            }
+            return;
+        }
         
-        const auto& current = wordCount;
-        const auto& previous = history.back().wordCount;
+        // 读取线程每读一批先取一张票，调用线程处理完该批后归还：在途批次（队列中、分词中、
+        // 等待重排的）总数不超过 inFlight，一个慢批次卡住 nextSeq 时重排缓冲也不会无限增长
+        size_t inFlight = workers * 4;
+        BoundedQueue<int> tickets(inFlight);
+        for (size_t i = 0; i < inFlight; ++i) {
+            tickets.push(0);
+        }
+        BoundedQueue<Batch> pending(inFlight);
+        BoundedQueue<Batch> done(inFlight);
+        BoundedQueue<Batch> recycled(inFlight + 1);  // 已处理完、可复用的批次
+        std::atomic<size_t> running(workers);
         
-        for (const auto& pair : current) {
-            const std::string& word = pair.first;
-            int currentCount = pair.second;
-            
-            auto it = previous.find(word);
-            int previousCount = (it != previous.end()) ? it->second : 0;
-            
-            if (previousCount == 0 && currentCount > 0) {
-                // 新词，增长率100%
-                if (currentCount >= 3) {  // 至少出现3次才算新兴
-                    emerging.push_back({word, 100.0});
+        std::thread reader([&]() {
+            size_t seq = 0;
+            int number = 0;
+            bool more = true;
+            int ticket;
+            while (more && tickets.pop(ticket)) {
+                Batch batch;
+                recycled.tryPop(batch);
+                batch.seq = seq++;
+                batch.count = 0;
+                while (batch.count < batchSize) {
+                    if (batch.count == batch.lines.size()) {
+                        batch.lines.push_back(InputLine());
+                    }
+                    InputLine& line = batch.lines[batch.count];
+                    if (!std::getline(input, line.text)) {
+                        more = false;
+                        break;
+                    }
+                    line.number = ++number;
+                    batch.count++;
                 }
-            } else if (previousCount > 0) {
-                double growth = ((double)(currentCount - previousCount) / previousCount) * 100.0;
-                if (growth >= threshold) {
-                    emerging.push_back({word, growth});
+                if (batch.count > 0) {
+                    pending.push(std::move(batch));
+                } else {
+                    tickets.push(0);
                 }
             }
-        }
-        
-        // 按增长率降序排序
-        std::sort(emerging.begin(), emerging.end(), 
-                  [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
-                      return a.second > b.second;
-                  });
+            pending.close();
+        });
         
-        return emerging;
-    }
-    
-    // 获取降温热词（下降率超过阈值）
-    std::vector<std::pair<std::string, double>> getCoolingWords(double threshold = 30.0) const {
-        std::vector<std::pair<std::string, double>> cooling;
-        
-        if (history.size() < 2) return cooling;
-        
-        const auto& current = wordCount;
-        const auto& previous = history.back().wordCount;
+        std::vector<std::thread> pool;
+        for (size_t i = 0; i < workers; ++i) {
+            pool.push_back(std::thread([&]() {
+                cppjieba::SegmentContext context;
+                Batch batch;
+                while (pending.pop(batch)) {
+                    for (size_t j = 0; j < batch.count; ++j) {
+                        prepareLine(jieba, context, batch.lines[j], cache, scanner, policy);
+                    }
+                    done.push(std::move(batch));
+                }
+                if (--running == 0) {
+                    done.close();
+                }
+            }));
+        }
         
-        for (const auto& pair : previous) {
-            const std::string& word = pair.first;
-            int previousCount = pair.second;
-            
-            auto it = current.find(word);
-            int currentCount = (it != current.end()) ? it->second : 0;
-            
-            if (previousCount > 0) {
-                double decline = ((double)(previousCount - currentCount) / previousCount) * 100.0;
-                if (decline >= threshold) {
-                    cooling.push_back({word, decline});
+        // 按批次序号重排：先完成的后续批次暂存，直到轮到它们。
+        // handle 可能更新词典（新词发现），此前已切好的行用的是旧词典，交给 handle 前在本线程重切，
+        // 使每行都按处理到它时的词典分词，结果与单线程一致
+        cppjieba::SegmentContext context;
+        std::map<size_t, Batch> reorder;
+        size_t nextSeq = 0;
+        Batch batch;
+        while (done.pop(batch)) {
+            size_t seq = batch.seq;
+            reorder[seq] = std::move(batch);
+            for (auto it = reorder.find(nextSeq); it != reorder.end(); it = reorder.find(nextSeq)) {
+                for (size_t j = 0; j < it->second.count; ++j) {
+                    InputLine& line = it->second.lines[j];
+                    // 重切不查也不写缓存，命中统计与单线程一致
+                    if (line.dictVersion != jieba.DictVersion()) {
+                        prepareLine(jieba, context, line, NULL, scanner, policy);
+                    }
+                    handle(line);
                 }
+                recycled.tryPush(std::move(it->second));
+                reorder.erase(it);
+                nextSeq++;
+                tickets.push(0);
             }
         }
         
-        // 按下降率降序排序
-        std::sort(cooling.begin(), cooling.end(), 
-                  [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
-                      return a.second > b.second;
-                  });
-        
-        return cooling;
-    }
-    
-    int getTotalWords() const { return totalWords; }
-    int getUniqueWords() const { return wordCount.size(); }
-    int getOutOfOrderCount() const { return outOfOrderCount; }
-    int getTotalMessageCount() const { return totalMessageCount; }
-    double getOutOfOrderRate() const { 
-        return totalMessageCount > 0 ? (double)outOfOrderCount / totalMessageCount * 100.0 : 0.0; 
+        reader.join();
+        for (auto& worker : pool) {
+            worker.join();
+        }
     }
     
-    // 动态调整窗口大小
-    void setWindowSize(int newSize) {
-        windowSize = newSize;
-        std::cout << "[INFO] Window size changed to " << newSize << " seconds (" 
-                  << (newSize/60) << " minutes)" << std::endl;
-    }
+private:
+    struct Batch {
+        size_t seq;  // 批次序号
+        size_t count;  // lines 中有效的行数，其余为待复用的空位
+        std::vector<InputLine> lines;
+        Batch() : seq(0), count(0) {}
+    };
     
-    int getWindowSize() const { return windowSize; }
+    const cppjieba::Jieba& jieba;
+    SegmentCache* cache;  // 可为空，多个分词线程共享
+    const SensitiveScanner* scanner;  // 可为空
+    SensitivePolicy policy;
+    size_t workers;
+    size_t batchSize;
 };
 
-// ============================================================================
-// 工具函数
-// ============================================================================
-
-// 解析时间戳 [H:MM:SS] 或 [H:M:S]
-bool parseTimestamp(const std::string& line, Timestamp& ts, std::string& content) {
-    if (line.empty() || line[0] != '[') return false;
-    
-    size_t endBracket = line.find(']');
-    if (endBracket == std::string::npos) return false;
-    
-    std::string timeStr = line.substr(1, endBracket - 1);
-    
-    // 解析时间
-    int h = 0, m = 0, s = 0;
-    char colon1, colon2;
-    std::istringstream iss(timeStr);
-    
-    if (!(iss >> h >> colon1 >> m >> colon2 >> s)) {
-        return false;
-    }
-    
-    ts = Timestamp(h, m, s);
-    
-    // 提取内容
-    if (endBracket + 2 < line.length()) {
-        content = line.substr(endBracket + 2);
-    } else {
-        content = "";
-    }
-    
-    return true;
-}
-
-// 解析QUERY命令
-bool parseQuery(const std::string& content, int& k) {
-    if (content.find("[ACTION]") != std::string::npos && 
-        content.find("QUERY") != std::string::npos) {
-        size_t kPos = content.find("K=");
-        if (kPos != std::string::npos) {
-            std::string kStr = content.substr(kPos + 2);
-            k = std::atoi(kStr.c_str());
-            return true;
-        }
-    }
-    return false;
-}
-
 // ============================================================================
 // 主程序
 // ============================================================================
@@ -416,33 +1972,168 @@ int main(int argc, char* argv[]) {
     std::cout << "  Hot Words Analysis System" << std::endl;
     std::cout << "========================================" << std::endl;
     
-    // 参数解析
+    // 参数解析：hotwords [输入文件] [输出文件[,输出文件...]] [窗口秒数[,窗口秒数...]]
+    //           [--bucket 秒] [--engine exact|sketch] [--memory MB] [--lateness 秒]
+    //           [--horizon 秒] [--threads 分词线程数]
+    //           [--dict-image 词典镜像] [--compile-dict [词典镜像]] [--cache 分词缓存条目数]
+    //           [--hmm-memo 未登录片段备忘条目数] [--filter-words 自定义过滤词文件]
+    //           [--sensitive-policy token|mask|drop] [--discover [新词最小频次]]
+    // 多个窗口大小共享一次分词；只给一个输出文件时按窗口大小派生文件名
+    limonp::ArgvContext args(argc, argv);
     std::string inputFile = "input1.txt";
     std::string outputFile = "hotwords_output.txt";
-    int windowSize = 600; // 默认10分钟窗口
+    std::vector<int> windowSizes;
+    int bucketSeconds = 1; // 默认1秒时间桶
+    std::string engineName = "exact"; // 默认精确计数
+    double sketchMemoryMB = 16.0; // 近似计数的内存预算
+    int lateness = -1; // 水位线允许的迟到秒数，默认不启用水位线
+    int horizon = 0; // 时间桶保留范围，默认等于最大窗口
+    size_t threads = 1; // 分词线程数，1 为串行处理
+    size_t cacheEntries = 0; // 分词缓存条目数，0 为不缓存
+    size_t hmmMemoEntries = 0; // HMM 切分备忘条目数，0 为关闭
+    std::string dictImagePath = "dict/jieba.img"; // 预编译词典镜像，存在且与词典文件一致时优先加载
+    std::string filterWordsFile; // 自定义过滤词，每行一词，不计入热词
+    std::string sensitivePolicyName = "token"; // 敏感词策略：过滤敏感词本身、屏蔽命中片段或丢弃整条消息
+    bool discoverWords = false; // 新词发现：查询时从窗口内的单字串挖掘新词并加入分词词典
+    int discoverMinCount = 5; // 新词在窗口内的最小频次
+    
+    if (!args[1].empty()) inputFile = args[1];
+    if (!args[2].empty()) outputFile = args[2];
+    if (!args[3].empty()) {
+        for (const auto& size : limonp::Split(args[3], ",")) {
+            windowSizes.push_back(std::atoi(size.c_str()));
+        }
+    }
+    if (windowSizes.empty()) windowSizes.push_back(600); // 默认10分钟窗口
+    if (args.HasKey("--bucket")) bucketSeconds = std::max(1, std::atoi(args["--bucket"].c_str()));
+    if (args.HasKey("--engine")) engineName = args["--engine"];
+    if (args.HasKey("--memory")) sketchMemoryMB = std::atof(args["--memory"].c_str());
+    if (args.HasKey("--lateness")) lateness = std::max(0, std::atoi(args["--lateness"].c_str()));
+    if (args.HasKey("--horizon")) horizon = std::max(0, std::atoi(args["--horizon"].c_str()));
+    if (args.HasKey("--threads")) threads = (size_t)std::max(1, std::atoi(args["--threads"].c_str()));
+    if (args.HasKey("--cache")) cacheEntries = (size_t)std::max(0, std::atoi(args["--cache"].c_str()));
+    if (args.HasKey("--hmm-memo")) hmmMemoEntries = (size_t)std::max(0, std::atoi(args["--hmm-memo"].c_str()));
+    if (!args["--dict-image"].empty()) dictImagePath = args["--dict-image"];
+    if (!args["--filter-words"].empty()) filterWordsFile = args["--filter-words"];
+    if (args.HasKey("--sensitive-policy")) sensitivePolicyName = args["--sensitive-policy"];
+    if (args.HasKey("--discover")) {
+        discoverWords = true;
+        if (!args["--discover"].empty()) discoverMinCount = std::max(2, std::atoi(args["--discover"].c_str()));
+    }
+    if (engineName != "exact" && engineName != "sketch") {
+        std::cerr << "[ERROR] Unknown counting engine: " << engineName << std::endl;
+        return EXIT_FAILURE;
+    }
+    SensitivePolicy sensitivePolicy;
+    if (sensitivePolicyName == "token") {
+        sensitivePolicy = SENSITIVE_DROP_TOKEN;
+    } else if (sensitivePolicyName == "mask") {
+        sensitivePolicy = SENSITIVE_MASK_SPAN;
+    } else if (sensitivePolicyName == "drop") {
+        sensitivePolicy = SENSITIVE_DROP_MESSAGE;
+    } else {
+        std::cerr << "[ERROR] Unknown sensitive word policy: " << sensitivePolicyName << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (engineName == "sketch" && sketchMemoryMB <= 0) {
+        std::cerr << "[ERROR] Sketch memory must be positive: " << sketchMemoryMB << std::endl;
+        return EXIT_FAILURE;
+    }
     
-    if (argc >= 2) inputFile = argv[1];
-    if (argc >= 3) outputFile = argv[2];
-    if (argc >= 4) windowSize = std::atoi(argv[3]);
+    std::vector<std::string> outputFiles = limonp::Split(outputFile, ",");
+    if (outputFiles.size() != windowSizes.size()) {
+        if (outputFiles.size() != 1) {
+            std::cerr << "[ERROR] Expected 1 or " << windowSizes.size() << " output files, got "
+                      << outputFiles.size() << std::endl;
+            return EXIT_FAILURE;
+        }
+        outputFiles.clear();
+        for (int size : windowSizes) {
+            outputFiles.push_back(windowOutputFile(outputFile, size));
+        }
+    }
     
     std::cout << "[CONFIG] Input file: " << inputFile << std::endl;
-    std::cout << "[CONFIG] Output file: " << outputFile << std::endl;
-    std::cout << "[CONFIG] Window size: " << windowSize << " seconds" << std::endl;
+    for (size_t w = 0; w < windowSizes.size(); ++w) {
+        std::cout << "[CONFIG] Output file: " << outputFiles[w] << std::endl;
+        std::cout << "[CONFIG] Window size: " << windowSizes[w] << " seconds" << std::endl;
+    }
+    std::cout << "[CONFIG] Bucket size: " << bucketSeconds << " seconds" << std::endl;
+    std::cout << "[CONFIG] Segmentation threads: " << threads << std::endl;
+    if (cacheEntries > 0) {
+        std::cout << "[CONFIG] Segmentation cache: " << cacheEntries << " entries" << std::endl;
+    }
+    if (hmmMemoEntries > 0) {
+        std::cout << "[CONFIG] HMM memo: " << hmmMemoEntries << " entries" << std::endl;
+    }
+    std::cout << "[CONFIG] Sensitive word policy: " << sensitivePolicyName << std::endl;
+    if (discoverWords) {
+        std::cout << "[CONFIG] New word discovery: minimum count " << discoverMinCount << std::endl;
+    }
+    if (lateness >= 0) {
+        std::cout << "[CONFIG] Watermark allowed lateness: " << lateness << " seconds" << std::endl;
+    }
     
-    // 初始化Jieba分词器
+    // 初始化Jieba分词器：镜像记录了各词典文件的大小和修改时间，文件变化后镜像失效，
+    // 回退到解析文本词典；--compile-dict 解析文本词典并写出镜像后退出
     std::cout << "[INIT] Initializing Jieba segmenter..." << std::endl;
-    cppjieba::Jieba jieba(
+    const std::vector<std::string> dictSources = {
         "dict/jieba.dict.utf8",
         "dict/hmm_model.utf8",
         "dict/user.dict.utf8",
         "dict/idf.utf8",
         "dict/stop_words.utf8"
-    );
+    };
+    bool compileDict = args.HasKey("--compile-dict");
+    cppjieba::DictImage dictImage; // 分词器引用镜像中的数据，须与其同生命周期
+    std::unique_ptr<cppjieba::Jieba> jiebaHolder;
+    if (!compileDict && dictImage.Open(dictImagePath) && dictImage.MatchesSources(dictSources)) {
+        jiebaHolder.reset(new cppjieba::Jieba(dictImage));
+        std::cout << "[INFO] Loaded dictionary image: " << dictImagePath << std::endl;
+    } else {
+        if (dictImage.IsOpen()) {
+            std::cout << "[WARN] Dictionary image " << dictImagePath
+                      << " is out of date, loading text dictionaries" << std::endl;
+        }
+        jiebaHolder.reset(new cppjieba::Jieba(dictSources[0], dictSources[1], dictSources[2],
+                                              dictSources[3], dictSources[4]));
+    }
+    jiebaHolder->SetHMMMemoCapacity(hmmMemoEntries);
+    const cppjieba::Jieba& jieba = *jiebaHolder;
     std::cout << "[INFO] Jieba initialized successfully." << std::endl;
     
+    if (compileDict) {
+        std::string imagePath = args["--compile-dict"].empty() ? dictImagePath : args["--compile-dict"];
+        if (!jieba.SaveImage(imagePath, dictSources)) {
+            std::cerr << "[ERROR] Failed to write dictionary image: " << imagePath << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "[INFO] Dictionary image written: " << imagePath << std::endl;
+        return EXIT_SUCCESS;
+    }
+    
     // 初始化滑动窗口
-    SlidingWindow window(windowSize);
-    window.loadStopWords("dict/stop_words.utf8");
+    WordTable wordTable;
+    WindowGroup windows(&wordTable, windowSizes, bucketSeconds,
+                        engineName == "sketch" ? sketchMemoryMB : 0, lateness, horizon);
+    if (!windows.sketchBudgetFits()) {
+        std::cerr << "[ERROR] Sketch memory " << sketchMemoryMB << " MB is too small for the time bucket ring, need at least "
+                  << std::fixed << std::setprecision(2) << windows.getRequiredSketchMB() << " MB" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (windows.getBucketSeconds() != bucketSeconds) {
+        std::cout << "[CONFIG] Sketch bucket size: " << windows.getBucketSeconds() << " seconds" << std::endl;
+    }
+    std::cout << "[CONFIG] Counting engine: " << windows[0].getEngineName() << std::endl;
+    std::cout << "[CONFIG] Retention horizon: " << windows.getHorizon() << " seconds" << std::endl;
+    
+    // 停用词、敏感词与自定义过滤词作为标记位记在词表中
+    int stopCount = wordTable.loadLexicon("dict/stop_words.utf8", WORD_STOP);
+    if (stopCount < 0) {
+        std::cerr << "[WARN] Cannot load stop words from: dict/stop_words.utf8" << std::endl;
+    } else {
+        std::cout << "[INFO] Loaded " << stopCount << " stop words." << std::endl;
+    }
     
     // 创建敏感词文件（如果不存在）
     std::ifstream testSensitive("dict/sensitive_words.utf8");
@@ -453,7 +2144,28 @@ int main(int argc, char* argv[]) {
     } else {
         testSensitive.close();
     }
-    window.loadSensitiveWords("dict/sensitive_words.utf8");
+    int sensitiveCount = wordTable.loadLexicon("dict/sensitive_words.utf8", WORD_SENSITIVE);
+    if (sensitiveCount < 0) {
+        std::cerr << "[WARN] Cannot load sensitive words from: dict/sensitive_words.utf8" << std::endl;
+    } else {
+        std::cout << "[INFO] Loaded " << sensitiveCount << " sensitive words." << std::endl;
+    }
+    if (!filterWordsFile.empty()) {
+        int filterCount = wordTable.loadLexicon(filterWordsFile, WORD_CUSTOM);
+        if (filterCount < 0) {
+            std::cerr << "[WARN] Cannot load filter words from: " << filterWordsFile << std::endl;
+        } else {
+            std::cout << "[INFO] Loaded " << filterCount << " filter words." << std::endl;
+        }
+    }
+    // 屏蔽片段与丢弃消息两种策略在分词前扫描原始内容
+    std::unique_ptr<SensitiveScanner> sensitiveScanner;
+    if (sensitivePolicy != SENSITIVE_DROP_TOKEN) {
+        sensitiveScanner.reset(new SensitiveScanner());
+        if (!sensitiveScanner->load("dict/sensitive_words.utf8")) {
+            std::cerr << "[WARN] Cannot build sensitive word scanner from: dict/sensitive_words.utf8" << std::endl;
+        }
+    }
     
     // 读取输入文件
     std::cout << "[PROCESS] Reading input file..." << std::endl;
@@ -463,226 +2175,165 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
     
-    // 打开输出文件
-    std::ofstream ofs(outputFile);
-    if (!ofs.is_open()) {
-        std::cerr << "[ERROR] Cannot open output file: " << outputFile << std::endl;
-        return EXIT_FAILURE;
+    // 打开输出文件（每个窗口一个）
+    std::vector<std::unique_ptr<std::ofstream>> outputs;
+    for (size_t w = 0; w < windows.size(); ++w) {
+        outputs.push_back(std::unique_ptr<std::ofstream>(new std::ofstream(outputFiles[w])));
+        std::ofstream& ofs = *outputs[w];
+        if (!ofs.is_open()) {
+            std::cerr << "[ERROR] Cannot open output file: " << outputFiles[w] << std::endl;
+            return EXIT_FAILURE;
+        }
+        
+        int windowSize = windows[w].getWindowSize();
+        ofs << "===== 热词统计与分析系统输出 =====" << std::endl;
+        ofs << "输入文件: " << inputFile << std::endl;
+        ofs << "窗口大小: " << windowSize << " 秒 (" << (windowSize/60) << " 分钟)" << std::endl;
+        ofs << "======================================" << std::endl << std::endl;
     }
     
-    ofs << "===== 热词统计与分析系统输出 =====" << std::endl;
-    ofs << "输入文件: " << inputFile << std::endl;
-    ofs << "窗口大小: " << windowSize << " 秒 (" << (windowSize/60) << " 分钟)" << std::endl;
-    ofs << "======================================" << std::endl << std::endl;
-    
-    // 处理数据流
-    std::string line;
+    // 处理数据流：分词可并发进行，窗口更新与查询按输入顺序在本线程完成
+    std::vector<WordId> wordIds;  // 词编号（跨行复用）
     int lineCount = 0;
     int queryCount = 0;
+    size_t malformedCount = 0;  // 修复的非法 UTF-8 序列数
+    int sensitiveMessages = 0;  // 命中敏感词的消息数（扫描策略下统计）
     
-    while (std::getline(ifs, line)) {
-        lineCount++;
-        
-        // 移除Windows换行符
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
-        
-        if (line.empty()) continue;
-        
-        Timestamp ts;
-        std::string content;
+    std::unique_ptr<SegmentCache> segmentCache(cacheEntries > 0 ? new SegmentCache(cacheEntries) : NULL);
+    // 新词发现覆盖最大的窗口；新词以新版本词典发布，分词线程无需停顿
+    std::unique_ptr<NewWordDiscovery> discovery;
+    if (discoverWords) {
+        discovery.reset(new NewWordDiscovery(*std::max_element(windowSizes.begin(), windowSizes.end()),
+                                             discoverMinCount));
+    }
+    auto acceptNewWord = [&](const std::string& word) {
+        // 词典中已有的词不重复加入；首尾为停用字（"的"、"了"）的片段不成词
+        if (jiebaHolder->Find(word)) return false;
+        size_t firstLen = NewWordDiscovery::firstCharLength(word);
+        size_t lastLen = NewWordDiscovery::lastCharLength(word);
+        return !(wordTable.lexiconFlags(word.substr(0, firstLen)) & WORD_STOP) &&
+               !(wordTable.lexiconFlags(word.substr(word.size() - lastLen)) & WORD_STOP) &&
+               !(wordTable.lexiconFlags(word) & (WORD_SENSITIVE | WORD_CUSTOM));
+    };
+    IngestPipeline pipeline(jieba, threads, segmentCache.get(), sensitiveScanner.get(), sensitivePolicy);
+    pipeline.run(ifs, [&](const InputLine& input) {
+        lineCount = input.number;
+        malformedCount += input.malformed;
+        if (!input.sensitiveSpans.empty()) sensitiveMessages++;
+        if (input.text.empty() || input.dropped) return;
         
-        if (!parseTimestamp(line, ts, content)) {
-            // 如果不是带时间戳的行，检查是否是QUERY命令
-            int k;
-            if (parseQuery(line, k)) {
-                queryCount++;
-                std::cout << "[QUERY " << queryCount << "] Top-" << k << " at line " << lineCount << std::endl;
-                
-                auto topK = window.getTopK(k);
-                
-                ofs << "[时间: 当前] Query #" << queryCount << " - Top-" << k << " 热词:" << std::endl;
-                for (size_t i = 0; i < topK.size(); ++i) {
-                    ofs << "  " << (i+1) << ". " << topK[i].word 
-                        << " (出现 " << topK[i].count << " 次)";
-                    
-                    // 添加趋势信息
-                    double trend = window.getTrend(topK[i].word);
-                    if (trend > 0) {
-                        ofs << " ↑" << std::fixed << std::setprecision(1) << trend << "%";
-                    } else if (trend < 0) {
-                        ofs << " ↓" << std::fixed << std::setprecision(1) << (-trend) << "%";
-                    }
-                    ofs << std::endl;
-                }
-                
-                // 显示新兴热词
-                auto emerging = window.getEmergingWords(50.0);
-                if (!emerging.empty() && queryCount > 1) {
-                    ofs << "\n  📈 新兴热词 (增长率>50%):" << std::endl;
-                    for (size_t i = 0; i < std::min(emerging.size(), (size_t)3); ++i) {
-                        ofs << "    • " << emerging[i].first << " (+" 
-                            << std::fixed << std::setprecision(1) << emerging[i].second << "%)" << std::endl;
-                    }
-                }
-                
-                // 显示降温热词
-                auto cooling = window.getCoolingWords(30.0);
-                if (!cooling.empty() && queryCount > 1) {
-                    ofs << "  📉 降温热词 (下降率>30%):" << std::endl;
-                    for (size_t i = 0; i < std::min(cooling.size(), (size_t)3); ++i) {
-                        ofs << "    • " << cooling[i].first << " (-" 
-                            << std::fixed << std::setprecision(1) << cooling[i].second << "%)" << std::endl;
-                    }
-                }
-                
-                ofs << std::endl;
-                window.saveSnapshot(Timestamp(0, 0, 0));
-                window.printStatistics();
-            }
-            continue;
-        }
+        const Timestamp& ts = input.ts;
+        bool hasTimestamp = input.hasTimestamp;
         
         // 检查是否是QUERY命令
-        int k;
-        if (parseQuery(content, k)) {
+        if (input.isQuery) {
+            int k = input.k;
             queryCount++;
-            std::cout << "[QUERY " << queryCount << "] Top-" << k << " at " << ts.toString() << std::endl;
-            
-            auto topK = window.getTopK(k);
-            
-            ofs << "[时间: " << ts.toString() << "] Query #" << queryCount << " - Top-" << k << " 热词:" << std::endl;
-            for (size_t i = 0; i < topK.size(); ++i) {
-                ofs << "  " << (i+1) << ". " << topK[i].word 
-                    << " (出现 " << topK[i].count << " 次)";
-                
-                // 添加趋势信息
-                double trend = window.getTrend(topK[i].word);
-                if (trend > 0) {
-                    ofs << " ↑" << std::fixed << std::setprecision(1) << trend << "%";
-                } else if (trend < 0) {
-                    ofs << " ↓" << std::fixed << std::setprecision(1) << (-trend) << "%";
+            if (hasTimestamp) {
+                std::cout << "[QUERY " << queryCount << "] Top-" << k << " at " << ts.toString();
+                if (lateness >= 0) {
+                    std::cout << " (watermark " << Timestamp::fromSeconds(std::max(0, windows.getWatermark())).toString() << ")";
                 }
-                ofs << std::endl;
+                std::cout << std::endl;
+            } else {
+                std::cout << "[QUERY " << queryCount << "] Top-" << k << " at line " << lineCount << std::endl;
             }
             
-            // 显示新兴热词
-            auto emerging = window.getEmergingWords(50.0);
-            if (!emerging.empty() && queryCount > 1) {
-                ofs << "\n  📈 新兴热词 (增长率>50%):" << std::endl;
-                for (size_t i = 0; i < std::min(emerging.size(), (size_t)3); ++i) {
-                    ofs << "    • " << emerging[i].first << " (+" 
-                        << std::fixed << std::setprecision(1) << emerging[i].second << "%)" << std::endl;
+            // 新发现的词一次性加入分词词典：只发布一个新版本，多线程时已切好的行只需重切一遍；
+            // 缓存中按旧词典得到的分词结果随之作废
+            std::vector<NewWordDiscovery::Candidate> newWords;
+            if (discovery) {
+                newWords = discovery->discover(acceptNewWord);
+                std::vector<std::string> words;
+                for (const auto& w : newWords) {
+                    words.push_back(w.word);
+                    std::cout << "[DISCOVER] " << w.word << " (count " << w.count << ")" << std::endl;
                 }
+                jiebaHolder->InsertUserWords(words, "nw");
             }
             
-            // 显示降温热词
-            auto cooling = window.getCoolingWords(30.0);
-            if (!cooling.empty() && queryCount > 1) {
-                ofs << "  📉 降温热词 (下降率>30%):" << std::endl;
-                for (size_t i = 0; i < std::min(cooling.size(), (size_t)3); ++i) {
-                    ofs << "    • " << cooling[i].first << " (-" 
-                        << std::fixed << std::setprecision(1) << cooling[i].second << "%)" << std::endl;
-                }
+            for (size_t w = 0; w < windows.size(); ++w) {
+                std::ofstream& ofs = *outputs[w];
+                ofs << "[时间: " << (hasTimestamp ? ts.toString() : "当前") << "] Query #" << queryCount
+                    << " - Top-" << k << " 热词:" << std::endl;
+                writeQueryResult(ofs, windows[w], k, queryCount);
+                writeDiscoveredWords(ofs, newWords);
+                windows[w].saveSnapshot(hasTimestamp ? ts : Timestamp(0, 0, 0));
+                windows[w].printStatistics();
             }
-            
-            ofs << std::endl;
-            
-            window.saveSnapshot(ts);
-            window.printStatistics();
-            continue;
+            return;
         }
+        // 检查是否是RESIZE命令：保留范围内的数据立即生效
+        if (input.isResize) {
+            for (size_t w = 0; w < windows.size(); ++w) {
+                if (input.windowNo > 0 && (size_t)input.windowNo != w + 1) continue;
+                int oldSize = windows[w].getWindowSize();
+                int size = windows.resizeWindow(w, input.newSize);
+                std::cout << "[RESIZE] Window " << (w + 1) << ": " << oldSize << " -> " << size
+                          << " seconds at line " << lineCount << std::endl;
+                *outputs[w] << "[窗口调整] 窗口大小: " << oldSize << " 秒 -> " << size << " 秒" << std::endl << std::endl;
+            }
+            return;
+        }
+        if (!hasTimestamp) return;
         
-        // 对内容进行分词
-        std::vector<std::string> words;
-        jieba.Cut(content, words, true);
+        // 将分词结果转换为编号（词表只在本线程修改）
+        wordTable.intern(input.content, input.spans, wordIds);
         
         // 添加到滑动窗口
-        window.addMessage(ts, words);
+        windows.addMessage(ts, wordIds);
+        if (discovery) discovery->addMessage(ts, input.content, input.spans);
         
         // 每1000行打印一次进度
         if (lineCount % 1000 == 0) {
             std::cout << "[PROGRESS] Processed " << lineCount << " lines..." << std::endl;
         }
-    }
+    });
+    
+    // 数据流结束，水位线之后暂存的数据全部生效
+    windows.flush();
     
     std::cout << "[INFO] Total lines processed: " << lineCount << std::endl;
     std::cout << "[INFO] Total queries: " << queryCount << std::endl;
-    std::cout << "[INFO] Out-of-order messages: " << window.getOutOfOrderCount() 
-              << " (" << std::fixed << std::setprecision(2) << window.getOutOfOrderRate() << "%)" << std::endl;
+    std::cout << "[INFO] Out-of-order messages: " << windows.getOutOfOrderCount() 
+              << " (" << std::fixed << std::setprecision(2) << windows.getOutOfOrderRate() << "%)" << std::endl;
+    std::cout << "[INFO] Late messages dropped: " << windows.getLateDroppedCount() << std::endl;
+    std::cout << "[INFO] Malformed UTF-8 sequences repaired: " << malformedCount << std::endl;
+    if (sensitiveScanner) {
+        std::cout << "[INFO] Messages with sensitive words: " << sensitiveMessages << std::endl;
+    }
+    if (discovery) {
+        std::cout << "[INFO] New words discovered: " << discovery->getDiscoveredCount() << std::endl;
+    }
+    if (segmentCache) {
+        std::cout << "[INFO] Segmentation cache hits: " << segmentCache->getHits() << " / "
+                  << segmentCache->getLookups() << " (" << std::fixed << std::setprecision(2)
+                  << segmentCache->getHitRate() << "%)" << std::endl;
+    }
     
     // 如果查询次数少于2次，自动执行一次最终查询以便生成趋势分析
     if (queryCount < 2 && lineCount > 0) {
         std::cout << "[AUTO] Executing automatic final query for trend analysis..." << std::endl;
         queryCount++;
         
-        auto topK = window.getTopK(10);
-        
-        ofs << "\n[时间: 最终] Query #" << queryCount << " - Top-10 热词（自动查询）:" << std::endl;
-        for (size_t i = 0; i < topK.size(); ++i) {
-            ofs << "  " << (i+1) << ". " << topK[i].word 
-                << " (出现 " << topK[i].count << " 次)";
-            
-            // 添加趋势信息
-            double trend = window.getTrend(topK[i].word);
-            if (trend > 0) {
-                ofs << " ↑" << std::fixed << std::setprecision(1) << trend << "%";
-            } else if (trend < 0) {
-                ofs << " ↓" << std::fixed << std::setprecision(1) << (-trend) << "%";
-            }
-            ofs << std::endl;
-        }
-        
-        // 显示新兴热词
-        auto emerging = window.getEmergingWords(50.0);
-        if (!emerging.empty() && queryCount > 1) {
-            ofs << "\n  📈 新兴热词 (增长率>50%):" << std::endl;
-            for (size_t i = 0; i < std::min(emerging.size(), (size_t)3); ++i) {
-                ofs << "    • " << emerging[i].first << " (+" 
-                    << std::fixed << std::setprecision(1) << emerging[i].second << "%)" << std::endl;
-            }
-        }
-        
-        // 显示降温热词
-        auto cooling = window.getCoolingWords(30.0);
-        if (!cooling.empty() && queryCount > 1) {
-            ofs << "  📉 降温热词 (下降率>30%):" << std::endl;
-            for (size_t i = 0; i < std::min(cooling.size(), (size_t)3); ++i) {
-                ofs << "    • " << cooling[i].first << " (-" 
-                    << std::fixed << std::setprecision(1) << cooling[i].second << "%)" << std::endl;
-            }
+        for (size_t w = 0; w < windows.size(); ++w) {
+            std::ofstream& ofs = *outputs[w];
+            ofs << "\n[时间: 最终] Query #" << queryCount << " - Top-10 热词（自动查询）:" << std::endl;
+            writeQueryResult(ofs, windows[w], 10, queryCount);
+            windows[w].saveSnapshot(Timestamp(99, 99, 99));
         }
-        
-        ofs << std::endl;
-        window.saveSnapshot(Timestamp(99, 99, 99));
     }
     
     // 输出最终统计
-    ofs << "\n===== 最终统计 =====" << std::endl;
-    ofs << "处理的总行数: " << lineCount << std::endl;
-    ofs << "处理的消息数: " << window.getTotalMessageCount() << std::endl;
-    ofs << "查询次数: " << queryCount << std::endl;
-    ofs << "窗口大小: " << window.getWindowSize() << " 秒 (" << (window.getWindowSize()/60) << " 分钟)" << std::endl;
-    ofs << "窗口内唯一词数: " << window.getUniqueWords() << std::endl;
-    ofs << "窗口内总词数: " << window.getTotalWords() << std::endl;
-    ofs << "乱序消息数: " << window.getOutOfOrderCount() 
-        << " (" << std::fixed << std::setprecision(2) << window.getOutOfOrderRate() << "%)" << std::endl;
-    
-    // 输出最终Top-20
-    ofs << "\n===== 最终 Top-20 热词 =====" << std::endl;
-    auto finalTop = window.getTopK(20);
-    for (size_t i = 0; i < finalTop.size(); ++i) {
-        ofs << "  " << (i+1) << ". " << finalTop[i].word 
-            << " (出现 " << finalTop[i].count << " 次)" << std::endl;
+    for (size_t w = 0; w < windows.size(); ++w) {
+        writeFinalStatistics(*outputs[w], windows, windows[w], lineCount, queryCount, engineName == "sketch",
+                             segmentCache.get(), sensitiveScanner ? sensitiveMessages : -1, discovery.get());
+        outputs[w]->close();
+        std::cout << "[SUCCESS] Analysis completed. Results saved to: " << outputFiles[w] << std::endl;
     }
     
-    ofs << "\n===== 分析完成 =====" << std::endl;
-    
     ifs.close();
-    ofs.close();
     
-    std::cout << "[SUCCESS] Analysis completed. Results saved to: " << outputFile << std::endl;
     std::cout << "========================================" << std::endl;
     
     return EXIT_SUCCESS;